@@ -1,56 +1,42 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <limits.h>
 #include <locale.h>
 #include <papi.h>
 #include <pthread.h>
 #include <time.h>
+#include <unistd.h>
 
 #include <babeltrace/babeltrace.h>
 #include <babeltrace/iterator.h>
 #include <babeltrace/ctf/iterator.h>
 #include <babeltrace/ctf/types.h>
 
+#include "packet_index.h"
+#include "parallel.h"
+#include "profile.h"
+#include "stream_table.h"
+
 #define NSECS_IN_MSEC 1000000
 #define NSECS_IN_SEC 1000000000
 #define BYTES_IN_MBYTE 1000000
+#define PAGE_SIZE 4096
+#define DEFAULT_META_CHUNK_SIZE (2048 * PAGE_SIZE)
+#define DEFAULT_PREFETCH 1
 
 uint64_t count = 0;
 uint64_t instr = 0;
+uint64_t cycles = 0;
 uint64_t size = 0;
 
-struct node {
-    int val;
-    struct node *next;
-};
-
-struct list {
-    struct node *head;
-    struct node *tail;
-};
-
-bool contains(struct list *l, int val) {
-    struct node *n = l->head;
-    while (n != NULL) {
-        if (n->val == val) return true;
-        n = n->next;
-    }
-    return false;
-}
-
-void append(struct list *l, int val) {
-    struct node *n = calloc(1, sizeof(struct node));
-    n->val = val;
-    if (l->tail == NULL) {
-        l->head = n;
-        l->tail = n;
-    } else {
-        l->tail->next = n;
-        l->tail = n;
-    }
-}
-
-struct list fds;
+struct stream_table streams;
+// Only recorded with a capacity
+struct packet_profile profile;
+// Packet index of the trace, to count events per stream
+struct trace_index *trace = NULL;
 
 off_t filesize(int fd) {
     struct stat stats;
@@ -62,22 +48,216 @@ off_t filesize(int fd) {
     return ret;
 }
 
+// File name of the stream at fd, malloc'ed
+char *stream_name(int fd) {
+    char link[64], path[PATH_MAX];
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    ssize_t len = readlink(link, path, sizeof(path) - 1);
+    if (len < 0) {
+        return strdup("?");
+    }
+    path[len] = '\0';
+    char *slash = strrchr(path, '/');
+    return strdup(slash ? slash + 1 : path);
+}
+
 void seek(struct bt_stream_pos *pos, size_t index, int whence) {
-    static uint64_t last_count = 0;
     struct ctf_stream_pos *p = ctf_pos(pos);
-    long long int values[1] = {0};
-    PAPI_read_counters(values, 1);
+    long long int values[2] = {0, 0};
+    // Counters restart from zero on each read, totals are kept here
+    PAPI_read_counters(values, 2);
     instr += values[0];
-    /*printf("packet size:%'lu events:%'lu instr:%'lld\n", p->content_size, count - last_count, values[0]);*/
-    last_count = count;
-    
-    // Have we seen this stream?
-    if (!contains(&fds, p->fd)) {
-        size += filesize(p->fd);
-        append(&fds, p->fd);
+    cycles += values[1];
+
+    bool created;
+    struct stream_stats *s = stream_table_get(&streams, p->fd, &created);
+
+    // Baselines are per stream, the seeks of the other streams
+    // interleaved with this one do not cut its packets short
+    if (profile.capacity > 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        // The first seek of a stream leaves no packet
+        if (!created && p->offset != EOF) {
+            struct packet_record *r = profile_next(&profile);
+            r->fd = p->fd;
+            r->packet = p->cur_index;
+            r->content_size = p->content_size / 8;
+            if (s->indexed >= 0 && p->cur_index < trace->streams[s->indexed].npackets) {
+                r->events = stream_packets(trace, s->indexed)[p->cur_index].events;
+            } else {
+                r->events = count - s->last_count;
+            }
+            r->instructions = instr - s->last_instructions;
+            r->cycles = cycles - s->last_cycles;
+            r->ns = (now.tv_sec - s->last_time.tv_sec) * NSECS_IN_SEC + now.tv_nsec - s->last_time.tv_nsec;
+        }
+        s->last_time = now;
+    }
+    s->last_count = count;
+    s->last_instructions = instr;
+    s->last_cycles = cycles;
+
+    if (created) {
+        s->size = filesize(p->fd);
+        size += s->size;
+        s->name = stream_name(p->fd);
+        if (trace) {
+            s->indexed = find_stream(trace, s->name);
+        }
     }
 
     ctf_packet_seek(pos, index, whence);
+
+    if (p->offset != EOF) {
+        s->packets++;
+        s->bytes += p->content_size / 8;
+        if (s->indexed >= 0 && p->cur_index < trace->streams[s->indexed].npackets) {
+            s->events += stream_packets(trace, s->indexed)[p->cur_index].events;
+        }
+    }
+}
+
+void print_streams(double time) {
+    struct stream_stats **sorted = stream_table_sorted(&streams);
+    for (size_t i = 0; i < streams.count; i++) {
+        struct stream_stats *s = sorted[i];
+        printf("stream %s: packets: %'lu bytes: %'lu bandwidth: %fMB/s", s->name, s->packets, s->bytes,
+                ((double)s->bytes/time)/(double)BYTES_IN_MBYTE);
+        if (s->indexed >= 0) {
+            printf(" events: %'lu events/s: %'.0f\n", s->events, s->events / time);
+        } else {
+            printf(" events: n/a\n");
+        }
+    }
+    free(sorted);
+}
+
+struct opts {
+    // 0 decodes all the streams merged on this thread
+    int threads;
+    bool merge_timestamps;
+    bool index;
+    uint64_t begin;
+    uint64_t end;
+    bool raw;
+    long meta_chunk_size;
+    int prefetch;
+    // Packets kept by the profile, 0 to disable
+    long profile;
+    enum profile_format format;
+};
+
+__attribute__((noreturn))
+void usage(void) {
+    fprintf(stderr, "Usage: babeltrace-test [OPTIONS] trace\n");
+    fprintf(stderr, "\nOptions:\n\n");
+    fprintf(stderr, "  --threads, -j    decode each stream on its own worker, over that many threads\n");
+    fprintf(stderr, "  --merge-timestamps, -m\n");
+    fprintf(stderr, "                   with --threads, keep the timestamps of the decoded events and\n");
+    fprintf(stderr, "                   merge them across streams, to time ordering them\n");
+    fprintf(stderr, "  --index, -x      use the packet index of the trace, building it if needed;\n");
+    fprintf(stderr, "                   with --threads, workers decode ranges of packets\n");
+    fprintf(stderr, "  --begin, -b      only read events from this time, in ns\n");
+    fprintf(stderr, "  --end, -e        only read events up to this time, in ns\n");
+    fprintf(stderr, "  --raw, -r        read packets in place from mapped stream files, without\n");
+    fprintf(stderr, "                   decoding, to measure I/O alone (implies --index)\n");
+    fprintf(stderr, "  --meta-chunk-size, -c\n");
+    fprintf(stderr, "                   with --raw, map up to that many bytes of packets at once\n");
+    fprintf(stderr, "  --prefetch, -f   with --raw, read that many metachunks ahead (0 to disable)\n");
+    fprintf(stderr, "  --profile, -p    profile the decoding of each packet, keeping the last that many\n");
+    fprintf(stderr, "                   and summarizing them, without --threads\n");
+    fprintf(stderr, "  --format, -o     with --profile, also print the packets kept as csv or json\n");
+    exit(EXIT_FAILURE);
+}
+
+void parse_opts(int argc, char **argv, struct opts *opts) {
+    struct option options[] = {
+        { "help",   0, 0, 'h' },
+        { "merge-timestamps",   0, 0, 'm' },
+        { "index",   0, 0, 'x' },
+        { "raw",   0, 0, 'r' },
+        { "threads",   1, 0, 'j' },
+        { "begin",   1, 0, 'b' },
+        { "end",   1, 0, 'e' },
+        { "meta-chunk-size",   1, 0, 'c' },
+        { "prefetch",   1, 0, 'f' },
+        { "profile",   1, 0, 'p' },
+        { "format",   1, 0, 'o' },
+        { 0, 0, 0, 0 },
+    };
+    int opt, idx;
+
+    while ((opt = getopt_long(argc, argv, "hmxrj:b:e:c:f:p:o:", options, &idx)) != -1) {
+        switch (opt) {
+            case 'j':
+                opts->threads = atoi(optarg);
+                break;
+            case 'm':
+                opts->merge_timestamps = true;
+                break;
+            case 'x':
+                opts->index = true;
+                break;
+            case 'r':
+                opts->raw = true;
+                opts->index = true;
+                break;
+            case 'c':
+                opts->meta_chunk_size = atol(optarg);
+                if (opts->meta_chunk_size < 0) {
+                    fprintf(stderr, "Invalid meta chunk size: %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'f':
+                opts->prefetch = atoi(optarg);
+                if (opts->prefetch < 0) {
+                    fprintf(stderr, "Invalid prefetch: %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'p':
+                opts->profile = atol(optarg);
+                break;
+            case 'o':
+                if (strcmp(optarg, "csv") == 0) {
+                    opts->format = PROFILE_CSV;
+                } else if (strcmp(optarg, "json") == 0) {
+                    opts->format = PROFILE_JSON;
+                } else {
+                    fprintf(stderr, "Unknown format: %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'b':
+                opts->begin = strtoull(optarg, NULL, 0);
+                break;
+            case 'e':
+                opts->end = strtoull(optarg, NULL, 0);
+                break;
+            case 'h':
+            default:
+                usage();
+        }
+    }
+
+    if (optind != argc - 1) {
+        fprintf(stderr, "No trace path provided.\n");
+        usage();
+    }
+    if (opts->profile > 0 && (opts->threads > 0 || opts->raw)) {
+        fprintf(stderr, "--profile only works on the sequential decoder.\n");
+        usage();
+    }
+    if (opts->raw && opts->merge_timestamps) {
+        fprintf(stderr, "--merge-timestamps needs decoded events, not --raw.\n");
+        usage();
+    }
+    // Reading in place is done by the workers
+    if (opts->raw && opts->threads == 0) {
+        opts->threads = 1;
+    }
 }
 
 struct timespec time_diff(struct timespec start,struct timespec end) {
@@ -100,20 +280,47 @@ int main(int argc, char **argv) {
     int trace_id;
     struct timespec start, end;
 
-    if (argc != 2) {
-        fprintf(stderr, "No trace path provided.\n");
-        exit(EXIT_FAILURE);
-    }
+    struct opts opts = { 0, false, false, 0, UINT64_MAX, false, DEFAULT_META_CHUNK_SIZE, DEFAULT_PREFETCH,
+        0, PROFILE_NONE };
+    struct trace_index index;
+    parse_opts(argc, argv, &opts);
 
-    trace_path = argv[1];
+    trace_path = argv[optind];
     setlocale(LC_NUMERIC, "");
-    int events[] = {PAPI_TOT_INS};
-    long long int values[1];
+    if (opts.index && trace_index_open(trace_path, &index) < 0) {
+        // Missing or stale
+        if (build_packet_index(trace_path, opts.threads > 0 ? opts.threads : 1) != EXIT_SUCCESS ||
+                trace_index_open(trace_path, &index) < 0) {
+            fprintf(stderr, "Failed: packet index of %s\n", trace_path);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (opts.threads > 0) {
+        struct decode_opts decode = { opts.threads, opts.merge_timestamps, opts.begin, opts.end,
+            opts.index ? &index : NULL, opts.raw, opts.meta_chunk_size, opts.prefetch };
+        int ret = decode_parallel(trace_path, &decode);
+        if (opts.index) {
+            trace_index_close(&index);
+        }
+        return ret;
+    }
+
+    int events[] = {PAPI_TOT_INS, PAPI_TOT_CYC};
+    long long int values[2];
 
     PAPI_library_init(PAPI_VER_CURRENT);
     /*PAPI_thread_init(pthread_self);*/
 
-    PAPI_start_counters(events, 1);
+    PAPI_start_counters(events, 2);
+
+    stream_table_init(&streams);
+    if (opts.profile > 0 && profile_init(&profile, opts.profile) < 0) {
+        fprintf(stderr, "Error: cannot allocate a profile of %ld packets\n", opts.profile);
+        exit(EXIT_FAILURE);
+    }
+    if (opts.index) {
+        trace = &index;
+    }
 
     clock_gettime(CLOCK_MONOTONIC, &start);
     ctx = bt_context_create();
@@ -123,22 +330,45 @@ int main(int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
 
-    iter = bt_ctf_iter_create(ctx, NULL, NULL);
+    struct bt_iter_pos begin_pos, end_pos;
+    begin_pos.type = BT_SEEK_TIME;
+    begin_pos.u.seek_time = opts.begin;
+    end_pos.type = BT_SEEK_TIME;
+    end_pos.u.seek_time = opts.end;
+    iter = bt_ctf_iter_create(ctx, opts.begin > 0 ? &begin_pos : NULL,
+            opts.end < UINT64_MAX ? &end_pos : NULL);
 
     while ((ctf_event = bt_ctf_iter_read_event(iter))) {
-        bt_iter_next(bt_ctf_get_iter(iter));
+        // Counted first, so that an event counts for its packet when
+        // moving on seeks to the next one
         count++;
+        bt_iter_next(bt_ctf_get_iter(iter));
     }
-    PAPI_read_counters(values, 1);
+    PAPI_read_counters(values, 2);
     instr += values[0];
 
     clock_gettime(CLOCK_MONOTONIC, &end);
+    if (opts.index) {
+        // Only what the time range covers
+        size = packet_bytes(&index, opts.begin, opts.end);
+    }
     struct timespec diff = time_diff(start, end);
     double time = (double)diff.tv_sec + ((double)diff.tv_nsec / (double)NSECS_IN_SEC);
     printf("Time : %ld.%lds\n", diff.tv_sec, diff.tv_nsec / NSECS_IN_MSEC);
     printf("Bandwidth : %fMB/s\n", ((double)size/time)/(double)BYTES_IN_MBYTE);
     
     printf("events: %'lu instr/event: %'lu total instr: %'lu\n", count, instr/count, instr);
+    print_streams(time);
+    if (opts.profile > 0) {
+        profile_summary(&profile);
+        profile_dump(&profile, &streams, opts.format);
+        profile_free(&profile);
+    }
+
+    stream_table_free(&streams);
+    if (opts.index) {
+        trace_index_close(&index);
+    }
 
     return 0;
 }
@@ -0,0 +1,316 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <babeltrace/babeltrace.h>
+#include <babeltrace/iterator.h>
+#include <babeltrace/ctf/iterator.h>
+#include <babeltrace/ctf/types.h>
+
+#include "packet_index.h"
+
+// State of index_stream() on the calling thread, for its seek callback
+struct recorder {
+    struct packet_entry *packets;
+    size_t npackets;
+    // Events read so far, and when the current packet was entered
+    uint64_t events;
+    uint64_t last;
+    // Current packet, -1 if none
+    int64_t cur;
+};
+
+static __thread struct recorder *recorder;
+
+static void record_seek(struct bt_stream_pos *pos, size_t index, int whence) {
+    struct ctf_stream_pos *p = ctf_pos(pos);
+    struct recorder *r = recorder;
+
+    // Events read since the last switch were all in the packet we leave
+    if (r->cur >= 0) {
+        r->packets[r->cur].events += r->events - r->last;
+    }
+    r->last = r->events;
+
+    ctf_packet_seek(pos, index, whence);
+
+    // Babeltrace has built its own index of the stream when it first
+    // seeks, empty packets it skips over included
+    if (r->packets == NULL && p->packet_index->len > 0) {
+        r->npackets = p->packet_index->len;
+        r->packets = calloc(r->npackets, sizeof(struct packet_entry));
+        for (size_t i = 0; i < r->npackets; i++) {
+            struct packet_index *pi = &g_array_index(p->packet_index, struct packet_index, i);
+            struct packet_entry *e = &r->packets[i];
+            e->offset = pi->offset;
+            e->packet_size = pi->packet_size / 8;
+            e->content_size = pi->content_size / 8;
+            e->timestamp_begin = pi->ts_real.timestamp_begin;
+            e->timestamp_end = pi->ts_real.timestamp_end;
+        }
+    }
+
+    if (p->offset == EOF || p->cur_index >= r->npackets) {
+        r->cur = -1;
+    } else {
+        r->cur = p->cur_index;
+    }
+}
+
+int index_stream(const char *dir, struct packet_entry **packets, size_t *npackets) {
+    struct recorder r = { NULL, 0, 0, 0, -1 };
+    struct bt_context *ctx;
+    struct bt_ctf_iter *iter;
+
+    recorder = &r;
+    ctx = bt_context_create();
+    if (bt_context_add_trace(ctx, dir, "ctf", record_seek, NULL, NULL) < 0) {
+        bt_context_put(ctx);
+        recorder = NULL;
+        return -1;
+    }
+
+    iter = bt_ctf_iter_create(ctx, NULL, NULL);
+    while (bt_ctf_iter_read_event(iter)) {
+        // Counted first, moving on may switch packets
+        r.events++;
+        bt_iter_next(bt_ctf_get_iter(iter));
+    }
+    if (r.cur >= 0) {
+        r.packets[r.cur].events += r.events - r.last;
+    }
+    bt_ctf_iter_destroy(iter);
+    bt_context_put(ctx);
+    recorder = NULL;
+
+    *packets = r.packets;
+    *npackets = r.npackets;
+    return 0;
+}
+
+static int64_t mtime_ns(const struct stat *stats) {
+    return (int64_t)stats->st_mtim.tv_sec * 1000000000 + stats->st_mtim.tv_nsec;
+}
+
+static void index_path(const char *trace_path, const char *name, char *path) {
+    snprintf(path, PATH_MAX, "%s/%s", trace_path, name);
+}
+
+int trace_index_write(const char *trace_path, size_t nstreams, const char *const *names,
+        const struct packet_entry *const *packets, const size_t *npackets) {
+    struct trace_index_header header = { PACKET_INDEX_MAGIC, PACKET_INDEX_VERSION, nstreams, 0, 0 };
+    struct stream_entry *streams = calloc(nstreams, sizeof(struct stream_entry));
+    char path[PATH_MAX], tmp[PATH_MAX];
+    FILE *f;
+    bool written;
+
+    for (size_t i = 0; i < nstreams; i++) {
+        struct stat stats;
+        index_path(trace_path, names[i], path);
+        if (strlen(names[i]) >= PACKET_INDEX_NAME_MAX || stat(path, &stats) == -1) {
+            fprintf(stderr, "Error: cannot index %s\n", path);
+            free(streams);
+            return -1;
+        }
+        strcpy(streams[i].name, names[i]);
+        streams[i].size = stats.st_size;
+        streams[i].mtime_ns = mtime_ns(&stats);
+        streams[i].first_packet = header.npackets;
+        streams[i].npackets = npackets[i];
+        for (size_t j = 0; j < npackets[i]; j++) {
+            streams[i].events += packets[i][j].events;
+        }
+        header.npackets += npackets[i];
+    }
+
+    // Written aside then renamed, so that readers never map half an index
+    index_path(trace_path, PACKET_INDEX_NAME ".tmp", tmp);
+    index_path(trace_path, PACKET_INDEX_NAME, path);
+    f = fopen(tmp, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Error: cannot write %s: %s\n", tmp, strerror(errno));
+        free(streams);
+        return -1;
+    }
+    written = fwrite(&header, sizeof(header), 1, f) == 1 &&
+        fwrite(streams, sizeof(struct stream_entry), nstreams, f) == nstreams;
+    for (size_t i = 0; written && i < nstreams; i++) {
+        written = fwrite(packets[i], sizeof(struct packet_entry), npackets[i], f) == npackets[i];
+    }
+    free(streams);
+    // fclose() does not report errors of earlier writes, ferror() does
+    written = written && fflush(f) == 0 && !ferror(f);
+    if (!written) {
+        fprintf(stderr, "Error: cannot write %s: %s\n", tmp, strerror(errno));
+        fclose(f);
+        unlink(tmp);
+        return -1;
+    }
+    if (fclose(f) != 0 || rename(tmp, path) == -1) {
+        fprintf(stderr, "Error: cannot write %s: %s\n", path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// Stream files of the trace, as babeltrace finds them
+static size_t count_streams(const char *trace_path) {
+    DIR *dir = opendir(trace_path);
+    struct dirent *entry;
+    size_t n = 0;
+    if (dir == NULL) {
+        return 0;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        char path[PATH_MAX];
+        struct stat stats;
+        if (entry->d_name[0] == '.' || strcmp(entry->d_name, "metadata") == 0) {
+            continue;
+        }
+        index_path(trace_path, entry->d_name, path);
+        if (stat(path, &stats) == 0 && S_ISREG(stats.st_mode)) {
+            n++;
+        }
+    }
+    closedir(dir);
+    return n;
+}
+
+// Packets of each stream within those of the index, and names ended
+static bool is_valid(const struct trace_index *index) {
+    for (uint32_t i = 0; i < index->header->nstreams; i++) {
+        const struct stream_entry *s = &index->streams[i];
+        if (s->first_packet > index->header->npackets ||
+                s->npackets > index->header->npackets - s->first_packet ||
+                memchr(s->name, '\0', PACKET_INDEX_NAME_MAX) == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool is_current(const char *trace_path, const struct trace_index *index) {
+    if (index->header->nstreams != count_streams(trace_path)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < index->header->nstreams; i++) {
+        const struct stream_entry *s = &index->streams[i];
+        char path[PATH_MAX];
+        struct stat stats;
+        index_path(trace_path, s->name, path);
+        if (stat(path, &stats) == -1 || (uint64_t)stats.st_size != s->size || mtime_ns(&stats) != s->mtime_ns) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int trace_index_open(const char *trace_path, struct trace_index *index) {
+    char path[PATH_MAX];
+    struct stat stats;
+    const struct trace_index_header *header;
+    size_t left;
+    int fd;
+
+    index_path(trace_path, PACKET_INDEX_NAME, path);
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    if (fstat(fd, &stats) == -1 || (size_t)stats.st_size < sizeof(struct trace_index_header)) {
+        close(fd);
+        return -1;
+    }
+    index->length = stats.st_size;
+    index->base = mmap(NULL, index->length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (index->base == MAP_FAILED) {
+        return -1;
+    }
+
+    // Counts are checked against what is left of the file before being
+    // multiplied, so that a corrupt header cannot overflow the sizes
+    header = index->base;
+    left = index->length - sizeof(*header);
+    if (header->magic != PACKET_INDEX_MAGIC || header->version != PACKET_INDEX_VERSION ||
+            header->nstreams > left / sizeof(struct stream_entry)) {
+        munmap(index->base, index->length);
+        return -1;
+    }
+    left -= header->nstreams * sizeof(struct stream_entry);
+    if (header->npackets > left / sizeof(struct packet_entry) ||
+            header->npackets * sizeof(struct packet_entry) != left) {
+        munmap(index->base, index->length);
+        return -1;
+    }
+    index->header = header;
+    index->streams = (const struct stream_entry *)(header + 1);
+    index->packets = (const struct packet_entry *)(index->streams + header->nstreams);
+
+    if (!is_valid(index) || !is_current(trace_path, index)) {
+        munmap(index->base, index->length);
+        return -1;
+    }
+    return 0;
+}
+
+void trace_index_close(struct trace_index *index) {
+    munmap(index->base, index->length);
+}
+
+int64_t find_stream(const struct trace_index *index, const char *name) {
+    // Streams are in name order
+    int64_t lo = 0, hi = index->header->nstreams;
+    while (lo < hi) {
+        int64_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(index->streams[mid].name, name);
+        if (cmp == 0) {
+            return mid;
+        } else if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return -1;
+}
+
+const struct packet_entry *stream_packets(const struct trace_index *index, uint32_t stream) {
+    return index->packets + index->streams[stream].first_packet;
+}
+
+uint64_t find_packet(const struct trace_index *index, uint32_t stream, uint64_t timestamp) {
+    const struct packet_entry *packets = stream_packets(index, stream);
+    uint64_t lo = 0, hi = index->streams[stream].npackets;
+
+    // Packets of a stream do not overlap, so their ends are sorted
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (packets[mid].timestamp_end < timestamp) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+uint64_t packet_bytes(const struct trace_index *index, uint64_t begin, uint64_t end) {
+    uint64_t bytes = 0;
+    for (uint32_t s = 0; s < index->header->nstreams; s++) {
+        const struct packet_entry *packets = stream_packets(index, s);
+        for (uint64_t i = find_packet(index, s, begin);
+                i < index->streams[s].npackets && packets[i].timestamp_begin <= end; i++) {
+            bytes += packets[i].packet_size;
+        }
+    }
+    return bytes;
+}
@@ -0,0 +1,91 @@
+#ifndef BABELTRACE_TEST_PACKET_INDEX_H
+#define BABELTRACE_TEST_PACKET_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Packet index of a trace, kept in the trace directory under this name.
+// Babeltrace skips hidden files when opening the trace.
+#define PACKET_INDEX_NAME ".packet-index"
+#define PACKET_INDEX_MAGIC 0x50494458
+#define PACKET_INDEX_VERSION 1
+#define PACKET_INDEX_NAME_MAX 256
+
+// The file is a header, then a stream_entry per stream file in name
+// order, then the packet_entry of all the streams, packets of a stream
+// being contiguous and in file order. Fields are in host byte order and
+// naturally aligned, so the index is used straight from its mapping.
+struct trace_index_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nstreams;
+    uint32_t pad;
+    uint64_t npackets;
+};
+
+struct stream_entry {
+    // Name of the stream file within the trace directory
+    char name[PACKET_INDEX_NAME_MAX];
+    // Size and modification time of the file when indexed, an index
+    // not matching them is stale
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t first_packet;
+    uint64_t npackets;
+    uint64_t events;
+};
+
+struct packet_entry {
+    // In bytes, from the start of the stream file
+    uint64_t offset;
+    uint64_t packet_size;
+    uint64_t content_size;
+    // Real time of the packet, in nanoseconds
+    uint64_t timestamp_begin;
+    uint64_t timestamp_end;
+    uint64_t events;
+};
+
+// A mapped index
+struct trace_index {
+    void *base;
+    size_t length;
+    const struct trace_index_header *header;
+    const struct stream_entry *streams;
+    const struct packet_entry *packets;
+};
+
+// Decodes the only stream of the trace in dir, returning its packets
+// in a malloc'ed array of *npackets. Returns -1 if babeltrace cannot
+// open the trace. Can be called from many threads at once.
+int index_stream(const char *dir, struct packet_entry **packets, size_t *npackets);
+
+// Writes the index of the trace in trace_path from the packets of each
+// of its streams, given in the same order as names. Returns -1 on error.
+int trace_index_write(const char *trace_path, size_t nstreams, const char *const *names,
+        const struct packet_entry *const *packets, const size_t *npackets);
+
+// Maps the index of the trace in trace_path. Returns -1 if there is
+// none, or if it does not match the stream files any more.
+int trace_index_open(const char *trace_path, struct trace_index *index);
+void trace_index_close(struct trace_index *index);
+
+// Stream of the given file name, -1 if not in the index
+int64_t find_stream(const struct trace_index *index, const char *name);
+const struct packet_entry *stream_packets(const struct trace_index *index, uint32_t stream);
+// First packet of the stream that ends at or after timestamp, or
+// npackets if there is none
+uint64_t find_packet(const struct trace_index *index, uint32_t stream, uint64_t timestamp);
+// Bytes of the packets overlapping [begin, end], over all streams
+uint64_t packet_bytes(const struct trace_index *index, uint64_t begin, uint64_t end);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BABELTRACE_TEST_PACKET_INDEX_H
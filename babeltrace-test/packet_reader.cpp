@@ -0,0 +1,93 @@
+#include "packet_reader.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "util.h"
+
+// First field of a CTF packet header, in the byte order of the trace
+static const uint32_t CTF_MAGIC = 0xC1FC1FC1;
+
+// End of the metachunk starting at packet first: the packets that fit
+// in size bytes from its start, at least one
+static uint64_t metachunk_end(const packet_entry *packets, uint64_t npackets, uint64_t first, off_t size) {
+    uint64_t start = packets[first].offset;
+    uint64_t last = first + 1;
+    while (last < npackets && packets[last].offset + packets[last].packet_size - start <= (uint64_t)size) {
+        last++;
+    }
+    return last;
+}
+
+// Packets need not be 8-byte aligned, words are loaded with memcpy,
+// which compiles to plain loads
+static uint64_t scan(const char *data, uint64_t size) {
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < size / sizeof(uint64_t); i++) {
+        uint64_t word;
+        memcpy(&word, data + i * sizeof(uint64_t), sizeof(word));
+        sum += word;
+    }
+    return sum;
+}
+
+PacketReadResult read_packets(const std::string &path, const packet_entry *packets, uint64_t npackets,
+        const PacketReaderOptions &opts) {
+    PacketReadResult result;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Error: cannot open file %s: %s\n", path.c_str(), strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    off_t page = system_page_size();
+
+    for (uint64_t first = 0; first < npackets; ) {
+        uint64_t last = metachunk_end(packets, npackets, first, opts.meta_chunk_size);
+        off_t start = packets[first].offset;
+        off_t end = packets[last - 1].offset + packets[last - 1].packet_size;
+        off_t aligned = start - start % page;
+
+        // Not mapped yet, so read ahead through the page cache
+        if (opts.prefetch > 0 && last < npackets) {
+            off_t ahead = packets[last].offset;
+            uint64_t after = last;
+            for (int i = 0; i < opts.prefetch && after < npackets; i++) {
+                after = metachunk_end(packets, npackets, after, opts.meta_chunk_size);
+            }
+            off_t ahead_end = packets[after - 1].offset + packets[after - 1].packet_size;
+            posix_fadvise(fd, ahead, ahead_end - ahead, POSIX_FADV_WILLNEED);
+        }
+
+        char *base = static_cast<char *>(mmap(NULL, end - aligned, PROT_READ, MAP_SHARED, fd, aligned));
+        if (base == MAP_FAILED) {
+            fprintf(stderr, "Error: cannot map %s: %s\n", path.c_str(), strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        madvise(base, end - aligned, MADV_SEQUENTIAL);
+
+        for (uint64_t i = first; i < last; i++) {
+            const char *packet = base + (packets[i].offset - aligned);
+            uint32_t magic;
+            memcpy(&magic, packet, sizeof(magic));
+            if (magic != CTF_MAGIC && magic != __builtin_bswap32(CTF_MAGIC)) {
+                result.bad_packets++;
+            }
+            result.sum += scan(packet, packets[i].content_size);
+            result.events += packets[i].events;
+            result.bytes += packets[i].packet_size;
+            result.packets++;
+        }
+
+        munmap(base, end - aligned);
+        first = last;
+    }
+
+    close(fd);
+    return result;
+}
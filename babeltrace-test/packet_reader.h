@@ -0,0 +1,36 @@
+#ifndef BABELTRACE_TEST_PACKET_READER_H
+#define BABELTRACE_TEST_PACKET_READER_H
+
+#include <cstdint>
+#include <string>
+
+#include <sys/types.h>
+
+#include "packet_index.h"
+
+struct PacketReaderOptions {
+    // Most bytes of whole packets mapped at once, at least one packet
+    off_t meta_chunk_size = 0;
+    // Metachunks read ahead of the one being scanned, 0 to disable
+    int prefetch = 0;
+};
+
+struct PacketReadResult {
+    uint64_t packets = 0;
+    uint64_t events = 0;
+    uint64_t bytes = 0;
+    // Packets not starting with the CTF magic number
+    uint64_t bad_packets = 0;
+    // Of the content words, so that the scan is not optimized out
+    uint64_t sum = 0;
+};
+
+// Reads packets of the stream file at path without babeltrace, for the
+// I/O cost alone: metachunks of whole packets are mapped with
+// MADV_SEQUENTIAL, each packet is checked and scanned in place, and
+// the following metachunks are read ahead. Events are those the index
+// counted. Exits if the file cannot be opened or mapped.
+PacketReadResult read_packets(const std::string &path, const packet_entry *packets, uint64_t npackets,
+        const PacketReaderOptions &opts);
+
+#endif // BABELTRACE_TEST_PACKET_READER_H
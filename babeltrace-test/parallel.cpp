@@ -0,0 +1,472 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <tbb/tbb.h>
+
+#include <babeltrace/babeltrace.h>
+#include <babeltrace/iterator.h>
+#include <babeltrace/ctf/events.h>
+#include <babeltrace/ctf/iterator.h>
+
+#include "packet_reader.h"
+#include "per_thread.h"
+#include "perf_counters.h"
+#include "util.h"
+
+// With an index, streams are cut in about this many ranges per thread,
+// so that workers finishing early can pick up more
+static const int RANGES_PER_THREAD = 4;
+
+// A stream file of the trace
+struct Stream {
+    std::string path;
+    std::string name;
+    off_t size = 0;
+    // Directory holding links to the stream and the trace metadata,
+    // so that a babeltrace context only opens this stream
+    std::string view;
+};
+
+// Events of a stream within [begin, end], decoded on their own
+struct Range {
+    const Stream *stream;
+    uint64_t begin;
+    uint64_t end;
+    // Size of the packets in the range, the whole stream without index
+    uint64_t bytes = 0;
+    // Packets of the range, with an index
+    const packet_entry *packets = NULL;
+    uint64_t npackets = 0;
+
+    uint64_t events = 0;
+    // Only read in place
+    uint64_t bad_packets = 0;
+    // Creating the context and iterator, which parses the metadata and
+    // scans the packet headers of the stream, then reading the events
+    uint64_t setup_ns = 0;
+    uint64_t decode_ns = 0;
+    // Timestamp of each event, in order, only kept to merge them
+    std::vector<uint64_t> timestamps;
+};
+
+// Work done by each TBB thread
+struct DecoderStats {
+    DecoderStats() : tid(syscall(SYS_gettid)) {
+    }
+
+    pid_t tid;
+    uint64_t ranges = 0;
+    uint64_t events = 0;
+    uint64_t bytes = 0;
+    uint64_t setup_ns = 0;
+    uint64_t decode_ns = 0;
+    // Decoding only, setup excluded
+    uint64_t instructions = 0;
+};
+
+// Stages of the PerfCounters of decode_parallel()
+enum DecodeStage {
+    STAGE_SETUP,
+    STAGE_DECODE,
+};
+
+static std::string real_path(const std::string &path) {
+    char buf[PATH_MAX];
+    if (realpath(path.c_str(), buf) == NULL) {
+        fprintf(stderr, "Error: cannot resolve %s: %s\n", path.c_str(), strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    return buf;
+}
+
+static std::string base_name(const std::string &path) {
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+static void remove_views(const std::string &root, const std::vector<Stream> &streams) {
+    for (const Stream &stream : streams) {
+        unlink((stream.view + "/metadata").c_str());
+        unlink((stream.view + "/" + stream.name).c_str());
+        rmdir(stream.view.c_str());
+    }
+    rmdir(root.c_str());
+}
+
+// Finds the streams of the trace, in name order, and makes a view of
+// each under a temporary directory
+static std::string make_views(const std::string &trace_path, std::vector<Stream> &streams) {
+    std::string trace = real_path(trace_path);
+    std::string metadata = trace + "/metadata";
+
+    char root[] = "/tmp/babeltrace-test.XXXXXX";
+    if (mkdtemp(root) == NULL) {
+        fprintf(stderr, "Error: mkdtemp: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (const std::string &path : expand_inputs({trace})) {
+        if (path == metadata) {
+            continue;
+        }
+        Stream stream;
+        stream.path = path;
+        stream.name = base_name(path);
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd != -1) {
+            stream.size = get_filesize(fd);
+            close(fd);
+        }
+        stream.view = std::string(root) + "/" + std::to_string(streams.size());
+        if (mkdir(stream.view.c_str(), 0700) == -1 ||
+                symlink(metadata.c_str(), (stream.view + "/metadata").c_str()) == -1 ||
+                symlink(path.c_str(), (stream.view + "/" + stream.name).c_str()) == -1) {
+            fprintf(stderr, "Error: cannot link %s: %s\n", path.c_str(), strerror(errno));
+            streams.push_back(stream);
+            remove_views(root, streams);
+            exit(EXIT_FAILURE);
+        }
+        streams.push_back(stream);
+    }
+    return root;
+}
+
+// Calls work(i) for i in [0, n) from a pipeline on threads TBB threads
+static void run_on_workers(size_t n, int threads, const std::function<void(size_t)> &work) {
+    tbb::task_scheduler_init init(threads);
+
+    size_t next = 0;
+    tbb::filter_t<void, size_t> in(tbb::filter::serial_in_order,
+            [&](tbb::flow_control &fc) -> size_t {
+        if (next == n) {
+            fc.stop();
+            return 0;
+        }
+        return next++;
+    });
+    tbb::filter_t<size_t, void> process(tbb::filter::parallel, work);
+
+    tbb::parallel_pipeline(threads, in & process);
+}
+
+// One range per stream without index. With one, packets overlapping
+// [begin, end] are grouped into ranges of about the same number of
+// events, cut at packet starts.
+static std::vector<Range> make_ranges(const std::vector<Stream> &streams, const decode_opts &opts) {
+    std::vector<Range> ranges;
+    const trace_index *index = opts.index;
+    if (index == NULL) {
+        for (const Stream &stream : streams) {
+            Range range;
+            range.stream = &stream;
+            range.begin = opts.begin;
+            range.end = opts.end;
+            range.bytes = stream.size;
+            ranges.push_back(std::move(range));
+        }
+        return ranges;
+    }
+
+    uint64_t events = 0;
+    for (uint32_t s = 0; s < index->header->nstreams; s++) {
+        events += index->streams[s].events;
+    }
+    uint64_t target = std::max<uint64_t>(1, events / (opts.threads * RANGES_PER_THREAD));
+
+    for (uint32_t s = 0; s < index->header->nstreams; s++) {
+        const packet_entry *packets = stream_packets(index, s);
+        uint64_t npackets = index->streams[s].npackets;
+        size_t first = ranges.size();
+        uint64_t in_range = 0;
+        for (uint64_t i = find_packet(index, s, opts.begin);
+                i < npackets && packets[i].timestamp_begin <= opts.end; i++) {
+            // Timestamps must move forward for ranges not to overlap
+            if (ranges.size() == first ||
+                    (in_range >= target && packets[i].timestamp_begin > ranges.back().begin)) {
+                if (ranges.size() > first) {
+                    ranges.back().end = packets[i].timestamp_begin - 1;
+                }
+                Range range;
+                range.stream = &streams[s];
+                range.begin = ranges.size() == first ? opts.begin : packets[i].timestamp_begin;
+                range.end = opts.end;
+                range.packets = &packets[i];
+                ranges.push_back(std::move(range));
+                in_range = 0;
+            }
+            ranges.back().bytes += packets[i].packet_size;
+            ranges.back().npackets++;
+            in_range += packets[i].events;
+        }
+    }
+    return ranges;
+}
+
+// A context of its own for a range, and its iterator
+struct RangeDecoder {
+    struct bt_context *ctx = NULL;
+    struct bt_ctf_iter *iter = NULL;
+};
+
+// Sets up the decoder of a range, positioned on its first event.
+// Packets are sought with the default ctf_packet_seek. Returns -1 if
+// babeltrace cannot open the stream.
+static int open_range(const Range &range, RangeDecoder &decoder) {
+    decoder.ctx = bt_context_create();
+    if (bt_context_add_trace(decoder.ctx, range.stream->view.c_str(), "ctf", NULL, NULL, NULL) < 0) {
+        fprintf(stderr, "Failed: bt_context_add_trace %s\n", range.stream->path.c_str());
+        bt_context_put(decoder.ctx);
+        return -1;
+    }
+
+    struct bt_iter_pos begin, end;
+    begin.type = BT_SEEK_TIME;
+    begin.u.seek_time = range.begin;
+    end.type = BT_SEEK_TIME;
+    end.u.seek_time = range.end;
+    decoder.iter = bt_ctf_iter_create(decoder.ctx, range.begin > 0 ? &begin : NULL,
+            range.end < UINT64_MAX ? &end : NULL);
+    return 0;
+}
+
+static void close_range(RangeDecoder &decoder) {
+    bt_ctf_iter_destroy(decoder.iter);
+    bt_context_put(decoder.ctx);
+}
+
+// Reads all the events of a range
+static void decode(Range &range, RangeDecoder &decoder, bool merge_timestamps) {
+    struct bt_ctf_event *event;
+    while ((event = bt_ctf_iter_read_event(decoder.iter))) {
+        if (merge_timestamps) {
+            range.timestamps.push_back(bt_ctf_get_timestamp(event));
+        }
+        range.events++;
+        bt_iter_next(bt_ctf_get_iter(decoder.iter));
+    }
+}
+
+// K-way merge of the timestamps kept by the ranges, returns the number
+// merged
+static uint64_t merge_timestamps(const std::vector<Range> &ranges) {
+    typedef std::pair<uint64_t, size_t> Head;
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head> > heads;
+    std::vector<size_t> next(ranges.size(), 0);
+    for (size_t i = 0; i < ranges.size(); i++) {
+        if (!ranges[i].timestamps.empty()) {
+            heads.push(Head(ranges[i].timestamps[0], i));
+        }
+    }
+
+    uint64_t merged = 0;
+    while (!heads.empty()) {
+        size_t i = heads.top().second;
+        heads.pop();
+        merged++;
+        if (++next[i] < ranges[i].timestamps.size()) {
+            heads.push(Head(ranges[i].timestamps[next[i]], i));
+        }
+    }
+    return merged;
+}
+
+int decode_parallel(const char *trace_path, const struct decode_opts *opts) {
+    std::vector<Stream> streams;
+    std::string root = make_views(trace_path, streams);
+    if (streams.empty()) {
+        fprintf(stderr, "No stream in %s.\n", trace_path);
+        remove_views(root, streams);
+        return EXIT_FAILURE;
+    }
+    if (opts->index) {
+        for (size_t s = 0; s < streams.size(); s++) {
+            if (s >= opts->index->header->nstreams || streams[s].name != opts->index->streams[s].name) {
+                fprintf(stderr, "Packet index does not match the streams of %s.\n", trace_path);
+                remove_views(root, streams);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    PerfCounters counters({"setup", "decode"});
+    PerThread<DecoderStats> workers;
+    std::vector<Range> ranges = make_ranges(streams, *opts);
+    PacketReaderOptions reader;
+    reader.meta_chunk_size = opts->meta_chunk_size;
+    reader.prefetch = opts->prefetch;
+    std::atomic<uint64_t> sum(0);
+    std::atomic<bool> failed(false);
+    struct timespec start, decoded, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run_on_workers(ranges.size(), opts->threads, [&](size_t i) {
+        Range &range = ranges[i];
+        RangeDecoder decoder;
+        struct timespec t0, t1;
+
+        // Setting up the context is timed and counted apart from the
+        // decoding, which it would otherwise dwarf for small ranges
+        if (!opts->raw) {
+            CounterValues begin = counters.read();
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            int ret = open_range(range, decoder);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            counters.add(STAGE_SETUP, begin);
+            range.setup_ns = duration_ns(t0, t1);
+            if (ret < 0) {
+                failed = true;
+                return;
+            }
+        }
+
+        CounterValues begin = counters.read();
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        if (opts->raw) {
+            PacketReadResult read = read_packets(range.stream->path, range.packets, range.npackets, reader);
+            range.events = read.events;
+            range.bad_packets = read.bad_packets;
+            sum += read.sum;
+        } else {
+            decode(range, decoder, opts->merge_timestamps);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        CounterValues counts = counters.add(STAGE_DECODE, begin);
+        range.decode_ns = duration_ns(t0, t1);
+
+        if (!opts->raw) {
+            CounterValues closing = counters.read();
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            close_range(decoder);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            counters.add(STAGE_SETUP, closing);
+            range.setup_ns += duration_ns(t0, t1);
+        }
+
+        DecoderStats &stats = workers.local();
+        stats.ranges++;
+        stats.events += range.events;
+        stats.bytes += range.bytes;
+        stats.setup_ns += range.setup_ns;
+        stats.decode_ns += range.decode_ns;
+        stats.instructions += counts.values[COUNTER_INSTRUCTIONS];
+    });
+    clock_gettime(CLOCK_MONOTONIC, &decoded);
+    if (failed) {
+        remove_views(root, streams);
+        return EXIT_FAILURE;
+    }
+
+    uint64_t merged = 0;
+    if (opts->merge_timestamps) {
+        merged = merge_timestamps(ranges);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    remove_views(root, streams);
+
+    uint64_t count = 0;
+    uint64_t size = 0;
+    uint64_t bad_packets = 0;
+    uint64_t setup_ns = 0;
+    for (const Range &range : ranges) {
+        count += range.events;
+        size += range.bytes;
+        bad_packets += range.bad_packets;
+        setup_ns += range.setup_ns;
+    }
+
+    struct timespec diff = time_diff(start, end);
+    double time = to_seconds(diff);
+    printf("Time : %ld.%lds\n", diff.tv_sec, diff.tv_nsec / NSECS_IN_MSEC);
+    printf("Bandwidth : %fMB/s\n", ((double)size/time)/(double)BYTES_IN_MBYTE);
+    printf("streams: %zu ranges: %zu threads: %d events: %'lu events/s: %'.0f\n",
+            streams.size(), ranges.size(), opts->threads, count, count / time);
+    if (!opts->raw) {
+        printf("context setup: %fs over all ranges, left out of worker events/s and instr/event\n",
+                (double)setup_ns / NSECS_IN_SEC);
+    }
+    if (opts->raw) {
+        printf("read in place: metachunks of %ld bytes, prefetch %d, %'lu bad packets, sum %lx\n",
+                (long)opts->meta_chunk_size, opts->prefetch, bad_packets, sum.load());
+    }
+    if (opts->merge_timestamps) {
+        double merge_time = to_seconds(time_diff(decoded, end));
+        printf("timestamp merge: %'lu timestamps in %fs, %'.0f timestamps/s\n", merged, merge_time, merged / merge_time);
+    }
+
+    bool instr = counters.is_available(COUNTER_INSTRUCTIONS);
+    std::vector<DecoderStats *> all = workers.all();
+    for (size_t i = 0; i < all.size(); i++) {
+        const DecoderStats &w = *all[i];
+        double busy = (double)w.decode_ns / NSECS_IN_SEC;
+        printf("worker %zu (tid %d): ranges: %lu setup: %fs events: %'lu events/s: %'.0f bandwidth: %fMB/s",
+                i, w.tid, w.ranges, (double)w.setup_ns / NSECS_IN_SEC, w.events,
+                busy > 0 ? w.events / busy : 0.0,
+                busy > 0 ? ((double)w.bytes / busy) / (double)BYTES_IN_MBYTE : 0.0);
+        if (instr && w.events > 0) {
+            printf(" instr/event: %'lu\n", w.instructions / w.events);
+        } else {
+            printf(" instr/event: n/a\n");
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int build_packet_index(const char *trace_path, int threads) {
+    std::vector<Stream> streams;
+    std::string root = make_views(trace_path, streams);
+    std::vector<packet_entry *> packets(streams.size(), NULL);
+    std::vector<size_t> npackets(streams.size(), 0);
+    std::atomic<bool> failed(false);
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run_on_workers(streams.size(), threads, [&](size_t i) {
+        if (index_stream(streams[i].view.c_str(), &packets[i], &npackets[i]) < 0) {
+            fprintf(stderr, "Failed: bt_context_add_trace %s\n", streams[i].path.c_str());
+            failed = true;
+        }
+    });
+    remove_views(root, streams);
+
+    std::vector<const char *> names;
+    uint64_t total = 0;
+    for (size_t i = 0; i < streams.size(); i++) {
+        names.push_back(streams[i].name.c_str());
+        total += npackets[i];
+    }
+    if (!failed) {
+        failed = trace_index_write(trace_path, streams.size(), names.data(), packets.data(), npackets.data()) < 0;
+    }
+    for (packet_entry *p : packets) {
+        free(p);
+    }
+    if (failed) {
+        return EXIT_FAILURE;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    struct timespec diff = time_diff(start, end);
+    printf("Indexed %zu streams, %'lu packets in %ld.%lds\n", streams.size(), total,
+            diff.tv_sec, diff.tv_nsec / NSECS_IN_MSEC);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,51 @@
+#ifndef BABELTRACE_TEST_PARALLEL_H
+#define BABELTRACE_TEST_PARALLEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "packet_index.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct decode_opts {
+    int threads;
+    // K-way merge the timestamps of the decoded events across ranges,
+    // the events themselves are not kept
+    bool merge_timestamps;
+    // Only events in [begin, end], in nanoseconds of real time
+    uint64_t begin;
+    uint64_t end;
+    // With an index, streams are split in ranges of packets, else each
+    // stream is one range
+    const struct trace_index *index;
+    // Read the packets of each range in place from the stream files,
+    // without decoding, which needs the index. Ranges then hold whole
+    // packets overlapping [begin, end].
+    bool raw;
+    long meta_chunk_size;
+    int prefetch;
+};
+
+// Decodes the CTF trace in trace_path range by range, each with its
+// own babeltrace context, the ranges being handed to opts->threads TBB
+// workers through a pipeline. With merge_timestamps, the timestamp of
+// each decoded event is kept (8 bytes per event) and the timestamps are
+// then merged across ranges, which times ordering them as the
+// sequential iterator would, not an ordered decode. With raw, ranges
+// are read by read_packets() instead. Prints time, bandwidth, context
+// setup time, and events/s and instructions/event of each worker, setup
+// excluded. Returns an exit status.
+int decode_parallel(const char *trace_path, const struct decode_opts *opts);
+
+// Decodes the streams of the trace on threads workers and writes their
+// packet index in the trace directory. Returns an exit status.
+int build_packet_index(const char *trace_path, int threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BABELTRACE_TEST_PARALLEL_H
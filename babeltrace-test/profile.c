@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+
+#define NSECS_IN_SEC 1000000000
+#define BYTES_IN_MBYTE 1000000
+
+// Content sizes of the summary, by powers of 4 from 4 KiB
+#define SIZE_CLASSES 8
+#define SMALLEST_SIZE_CLASS 4096
+
+int profile_init(struct packet_profile *profile, size_t capacity) {
+    profile->records = calloc(capacity, sizeof(struct packet_record));
+    if (profile->records == NULL) {
+        profile->capacity = 0;
+        return -1;
+    }
+    profile->capacity = capacity;
+    profile->next = 0;
+    profile->total = 0;
+    return 0;
+}
+
+void profile_free(struct packet_profile *profile) {
+    free(profile->records);
+    profile->records = NULL;
+    profile->capacity = 0;
+}
+
+static size_t kept(const struct packet_profile *profile) {
+    return profile->total < profile->capacity ? profile->total : profile->capacity;
+}
+
+// i-th record kept, oldest first
+static const struct packet_record *record_at(const struct packet_profile *profile, size_t i) {
+    size_t first = profile->total < profile->capacity ? 0 : profile->next;
+    return &profile->records[(first + i) % profile->capacity];
+}
+
+void profile_dump(const struct packet_profile *profile, const struct stream_table *table,
+        enum profile_format format) {
+    if (format == PROFILE_CSV) {
+        printf("stream,packet,content_size,events,instructions,cycles,ns\n");
+    }
+    for (size_t i = 0; i < kept(profile); i++) {
+        const struct packet_record *r = record_at(profile, i);
+        const struct stream_stats *s = stream_table_find(table, r->fd);
+        const char *name = s && s->name ? s->name : "?";
+        if (format == PROFILE_CSV) {
+            printf("%s,%u,%lu,%lu,%ld,%ld,%lu\n", name, r->packet, r->content_size, r->events,
+                    r->instructions, r->cycles, r->ns);
+        } else if (format == PROFILE_JSON) {
+            printf("{\"stream\": \"%s\", \"packet\": %u, \"content_size\": %lu, \"events\": %lu, "
+                    "\"instructions\": %ld, \"cycles\": %ld, \"ns\": %lu}\n", name, r->packet,
+                    r->content_size, r->events, r->instructions, r->cycles, r->ns);
+        }
+    }
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double da = *(const double *)a, db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+// Sorts values and prints their distribution on one line
+static void print_distribution(const char *name, double *values, size_t n) {
+    double sum = 0;
+    if (n == 0) {
+        printf("%s: n/a\n", name);
+        return;
+    }
+    qsort(values, n, sizeof(double), compare_doubles);
+    for (size_t i = 0; i < n; i++) {
+        sum += values[i];
+    }
+    printf("%s: min %'.1f p50 %'.1f p90 %'.1f p99 %'.1f max %'.1f mean %'.1f\n", name,
+            values[0], values[n / 2], values[n * 90 / 100], values[n * 99 / 100], values[n - 1], sum / n);
+}
+
+static int size_class(uint64_t content_size) {
+    int c = 0;
+    uint64_t limit = SMALLEST_SIZE_CLASS;
+    while (content_size > limit && c < SIZE_CLASSES - 1) {
+        limit *= 4;
+        c++;
+    }
+    return c;
+}
+
+void profile_summary(const struct packet_profile *profile) {
+    size_t n = kept(profile);
+    double *values = malloc((n > 0 ? n : 1) * sizeof(double));
+    size_t m;
+
+    printf("packets profiled: %'lu, last %'zu kept\n", profile->total, n);
+
+    m = 0;
+    for (size_t i = 0; i < n; i++) {
+        values[m++] = record_at(profile, i)->events;
+    }
+    print_distribution("events/packet", values, m);
+
+    m = 0;
+    for (size_t i = 0; i < n; i++) {
+        values[m++] = record_at(profile, i)->ns;
+    }
+    print_distribution("ns/packet", values, m);
+
+    m = 0;
+    for (size_t i = 0; i < n; i++) {
+        const struct packet_record *r = record_at(profile, i);
+        if (r->ns > 0) {
+            values[m++] = ((double)r->content_size * NSECS_IN_SEC / r->ns) / BYTES_IN_MBYTE;
+        }
+    }
+    print_distribution("MB/s", values, m);
+
+    m = 0;
+    for (size_t i = 0; i < n; i++) {
+        const struct packet_record *r = record_at(profile, i);
+        if (r->events > 0) {
+            values[m++] = (double)r->ns / r->events;
+        }
+    }
+    print_distribution("ns/event", values, m);
+
+    m = 0;
+    for (size_t i = 0; i < n; i++) {
+        const struct packet_record *r = record_at(profile, i);
+        if (r->events > 0) {
+            values[m++] = (double)r->instructions / r->events;
+        }
+    }
+    print_distribution("instr/event", values, m);
+
+    m = 0;
+    for (size_t i = 0; i < n; i++) {
+        const struct packet_record *r = record_at(profile, i);
+        if (r->events > 0) {
+            values[m++] = (double)r->cycles / r->events;
+        }
+    }
+    print_distribution("cycles/event", values, m);
+    free(values);
+
+    // Which packet shapes are slow
+    uint64_t packets[SIZE_CLASSES] = {0}, events[SIZE_CLASSES] = {0}, ns[SIZE_CLASSES] = {0};
+    int64_t cycles[SIZE_CLASSES] = {0};
+    for (size_t i = 0; i < n; i++) {
+        const struct packet_record *r = record_at(profile, i);
+        int c = size_class(r->content_size);
+        packets[c]++;
+        events[c] += r->events;
+        ns[c] += r->ns;
+        cycles[c] += r->cycles;
+    }
+    uint64_t limit = SMALLEST_SIZE_CLASS;
+    for (int c = 0; c < SIZE_CLASSES; c++, limit *= 4) {
+        if (packets[c] == 0) {
+            continue;
+        }
+        printf("content %s %'lu KiB: packets: %'lu events/packet: %'.1f", c == SIZE_CLASSES - 1 ? ">" : "<=",
+                (c == SIZE_CLASSES - 1 ? limit / 4 : limit) / 1024, packets[c], (double)events[c] / packets[c]);
+        if (events[c] > 0) {
+            printf(" ns/event: %'.1f cycles/event: %'.1f\n", (double)ns[c] / events[c], (double)cycles[c] / events[c]);
+        } else {
+            printf(" ns/event: n/a\n");
+        }
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef BABELTRACE_TEST_PROFILE_H
+#define BABELTRACE_TEST_PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "stream_table.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// What it took to decode a packet, from the seek that entered it to the
+// seek of the same stream that left it. Events are exact with a packet
+// index, else they are all those read in between. With many streams
+// interleaved by the iterator (one per CPU with LTTng), counters and
+// time also cover the events of other streams read in between.
+struct packet_record {
+    int fd;
+    uint32_t packet;
+    // In bytes
+    uint64_t content_size;
+    uint64_t events;
+    int64_t instructions;
+    int64_t cycles;
+    uint64_t ns;
+};
+
+// Ring of the last records, allocated up front so that recording from
+// the seek callback only fills a slot
+struct packet_profile {
+    struct packet_record *records;
+    size_t capacity;
+    size_t next;
+    // Records ever taken, more than capacity once the ring wrapped
+    uint64_t total;
+};
+
+enum profile_format {
+    PROFILE_NONE,
+    PROFILE_CSV,
+    PROFILE_JSON,
+};
+
+// Returns -1 if the records cannot be allocated
+int profile_init(struct packet_profile *profile, size_t capacity);
+void profile_free(struct packet_profile *profile);
+
+static inline struct packet_record *profile_next(struct packet_profile *profile) {
+    struct packet_record *record = &profile->records[profile->next];
+    profile->next = profile->next + 1 == profile->capacity ? 0 : profile->next + 1;
+    profile->total++;
+    return record;
+}
+
+// Records kept, oldest first, one per line, named after the streams of
+// table. JSON gets one object per record.
+void profile_dump(const struct packet_profile *profile, const struct stream_table *table,
+        enum profile_format format);
+// Distribution of the per-packet costs, then costs by content size
+void profile_summary(const struct packet_profile *profile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BABELTRACE_TEST_PROFILE_H
@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "stream_table.h"
+
+#define INITIAL_BITS 6
+
+static size_t slot_of(const struct stream_table *table, int fd) {
+    // Fibonacci hashing, keeping the high bits of the product
+    return (size_t)(((uint32_t)fd * 2654435769u) >> (32 - table->bits));
+}
+
+static void alloc_slots(struct stream_table *table, int bits) {
+    table->bits = bits;
+    table->capacity = (size_t)1 << bits;
+    table->slots = calloc(table->capacity, sizeof(struct stream_stats));
+    for (size_t i = 0; i < table->capacity; i++) {
+        table->slots[i].fd = -1;
+    }
+}
+
+void stream_table_init(struct stream_table *table) {
+    table->count = 0;
+    alloc_slots(table, INITIAL_BITS);
+}
+
+void stream_table_free(struct stream_table *table) {
+    for (size_t i = 0; i < table->capacity; i++) {
+        free(table->slots[i].name);
+    }
+    free(table->slots);
+    table->slots = NULL;
+    table->capacity = 0;
+    table->count = 0;
+}
+
+static struct stream_stats *probe(const struct stream_table *table, int fd) {
+    size_t mask = table->capacity - 1;
+    size_t i = slot_of(table, fd);
+    while (table->slots[i].fd != -1 && table->slots[i].fd != fd) {
+        i = (i + 1) & mask;
+    }
+    return &table->slots[i];
+}
+
+static void grow(struct stream_table *table) {
+    struct stream_stats *old = table->slots;
+    size_t capacity = table->capacity;
+
+    alloc_slots(table, table->bits + 1);
+    for (size_t i = 0; i < capacity; i++) {
+        if (old[i].fd != -1) {
+            *probe(table, old[i].fd) = old[i];
+        }
+    }
+    free(old);
+}
+
+struct stream_stats *stream_table_get(struct stream_table *table, int fd, bool *created) {
+    struct stream_stats *s = probe(table, fd);
+    *created = s->fd == -1;
+    if (!*created) {
+        return s;
+    }
+
+    if (2 * (table->count + 1) > table->capacity) {
+        grow(table);
+        s = probe(table, fd);
+    }
+    memset(s, 0, sizeof(*s));
+    s->fd = fd;
+    s->indexed = -1;
+    table->count++;
+    return s;
+}
+
+const struct stream_stats *stream_table_find(const struct stream_table *table, int fd) {
+    const struct stream_stats *s = probe(table, fd);
+    return s->fd == -1 ? NULL : s;
+}
+
+static int by_name(const void *a, const void *b) {
+    const struct stream_stats *sa = *(struct stream_stats *const *)a;
+    const struct stream_stats *sb = *(struct stream_stats *const *)b;
+    return strcmp(sa->name ? sa->name : "", sb->name ? sb->name : "");
+}
+
+struct stream_stats **stream_table_sorted(const struct stream_table *table) {
+    struct stream_stats **sorted = malloc(table->count * sizeof(struct stream_stats *));
+    size_t n = 0;
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->slots[i].fd != -1) {
+            sorted[n++] = &table->slots[i];
+        }
+    }
+    qsort(sorted, n, sizeof(struct stream_stats *), by_name);
+    return sorted;
+}
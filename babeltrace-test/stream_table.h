@@ -0,0 +1,63 @@
+#ifndef BABELTRACE_TEST_STREAM_TABLE_H
+#define BABELTRACE_TEST_STREAM_TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// What the seek callback saw of a stream
+struct stream_stats {
+    // -1 in free slots
+    int fd;
+    // File name of the stream, set by the caller
+    char *name;
+    // Stream in the packet index, -1 without one
+    int64_t indexed;
+    uint64_t size;
+    uint64_t packets;
+    // Content of the packets entered
+    uint64_t bytes;
+    // Only known with an index
+    uint64_t events;
+    // Events read, counters and time at the last seek of this stream,
+    // which the record of the packet it leaves is taken from
+    uint64_t last_count;
+    uint64_t last_instructions;
+    uint64_t last_cycles;
+    struct timespec last_time;
+};
+
+// Open addressing table of stream_stats keyed by fd, with linear
+// probing. Kept at most half full, so that a lookup on each packet
+// seek costs about one probe whatever the number of streams.
+struct stream_table {
+    struct stream_stats *slots;
+    size_t capacity;
+    // log2(capacity), for the hash
+    int bits;
+    size_t count;
+};
+
+void stream_table_init(struct stream_table *table);
+void stream_table_free(struct stream_table *table);
+
+// Stats of the stream at fd, zeroed and with *created set the first
+// time fd is seen. Pointers are only valid until the next insertion.
+struct stream_stats *stream_table_get(struct stream_table *table, int fd, bool *created);
+
+// Stats of the stream at fd, NULL if not seen
+const struct stream_stats *stream_table_find(const struct stream_table *table, int fd);
+
+// The streams seen, sorted by name, in a malloc'ed array of table->count
+struct stream_stats **stream_table_sorted(const struct stream_table *table);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BABELTRACE_TEST_STREAM_TABLE_H
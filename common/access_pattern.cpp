@@ -0,0 +1,226 @@
+#include "access_pattern.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+static const char *const pattern_names[] = {
+    "sequential",
+    "random",
+    "strided",
+    "zipfian",
+};
+
+bool parse_pattern(const char *name, Pattern &pattern) {
+    for (int i = 0; i <= PATTERN_ZIPFIAN; i++) {
+        if (strcmp(name, pattern_names[i]) == 0) {
+            pattern = static_cast<Pattern>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *pattern_name(Pattern pattern) {
+    return pattern_names[pattern];
+}
+
+// SplitMix64, to derive well-mixed states from small seeds
+static uint64_t splitmix64(uint64_t &state) {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// xoshiro256** by Blackman and Vigna
+class Random {
+public:
+    Random(uint64_t seed) {
+        for (int i = 0; i < 4; i++) {
+            s[i] = splitmix64(seed);
+        }
+    }
+
+    uint64_t next() {
+        uint64_t result = rotl(s[1] * 5, 7) * 9;
+        uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    // Uniform in [0, bound), Lemire's multiply-shift with rejection
+    uint64_t below(uint64_t bound) {
+        unsigned __int128 m = (unsigned __int128)next() * bound;
+        uint64_t low = (uint64_t)m;
+        if (low < bound) {
+            uint64_t threshold = -bound % bound;
+            while (low < threshold) {
+                m = (unsigned __int128)next() * bound;
+                low = (uint64_t)m;
+            }
+        }
+        return m >> 64;
+    }
+
+    // Uniform in [0, 1)
+    double uniform() {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+private:
+    static uint64_t rotl(uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    uint64_t s[4];
+};
+
+// Zipf ranks in [1, n] by rejection-inversion (Hormann and Derflinger,
+// 1996): constant time and memory per sample, for any exponent above 0
+class ZipfSampler {
+public:
+    ZipfSampler(uint64_t n, double exponent) : n(n), exponent(exponent) {
+        h_integral_x1 = h_integral(1.5) - 1.0;
+        h_integral_n = h_integral(n + 0.5);
+        s = 2.0 - h_integral_inverse(h_integral(2.5) - h(2.0));
+    }
+
+    uint64_t sample(Random &random) {
+        while (true) {
+            double u = h_integral_n + random.uniform() * (h_integral_x1 - h_integral_n);
+            double x = h_integral_inverse(u);
+            double k = floor(x + 0.5);
+            if (k < 1) {
+                k = 1;
+            } else if (k > n) {
+                k = n;
+            }
+            if (k - x <= s || u >= h_integral(k + 0.5) - h(k)) {
+                return (uint64_t)k;
+            }
+        }
+    }
+
+private:
+    // log1p(x) / x and expm1(x) / x, accurate near 0
+    static double helper1(double x) {
+        return fabs(x) > 1e-8 ? log1p(x) / x : 1.0 - x * (0.5 - x * (1.0 / 3.0 - 0.25 * x));
+    }
+
+    static double helper2(double x) {
+        return fabs(x) > 1e-8 ? expm1(x) / x : 1.0 + x * 0.5 * (1.0 + x / 3.0 * (1.0 + 0.25 * x));
+    }
+
+    double h(double x) const {
+        return exp(-exponent * log(x));
+    }
+
+    double h_integral(double x) const {
+        double log_x = log(x);
+        return helper2((1.0 - exponent) * log_x) * log_x;
+    }
+
+    double h_integral_inverse(double x) const {
+        double t = x * (1.0 - exponent);
+        if (t < -1.0) {
+            t = -1.0;
+        }
+        return exp(helper1(t) * x);
+    }
+
+    uint64_t n;
+    double exponent;
+    double h_integral_x1;
+    double h_integral_n;
+    double s;
+};
+
+static void shuffle(std::vector<uint32_t> &v, Random &random) {
+    for (size_t i = v.size(); i > 1; i--) {
+        std::swap(v[i - 1], v[random.below(i)]);
+    }
+}
+
+std::vector<uint32_t> page_order(const PatternOptions &opts, uint64_t npages, uint64_t region) {
+    std::vector<uint32_t> order;
+    order.reserve(npages);
+    uint64_t state = opts.seed;
+    Random random(splitmix64(state) ^ region);
+
+    switch (opts.pattern) {
+        case PATTERN_SEQUENTIAL:
+            for (uint64_t i = 0; i < npages; i++) {
+                order.push_back(i);
+            }
+            break;
+        case PATTERN_RANDOM:
+            for (uint64_t i = 0; i < npages; i++) {
+                order.push_back(i);
+            }
+            shuffle(order, random);
+            break;
+        case PATTERN_STRIDED: {
+            uint64_t stride = opts.stride > 0 ? opts.stride : 1;
+            for (uint64_t start = 0; start < stride && start < npages; start++) {
+                for (uint64_t i = start; i < npages; i += stride) {
+                    order.push_back(i);
+                }
+            }
+            break;
+        }
+        case PATTERN_ZIPFIAN: {
+            if (npages == 0) {
+                break;
+            }
+            // Ranks go to pages through a permutation, so the hot
+            // pages are spread over the region instead of at its start
+            std::vector<uint32_t> pages;
+            for (uint64_t i = 0; i < npages; i++) {
+                pages.push_back(i);
+            }
+            shuffle(pages, random);
+            ZipfSampler zipf(npages, opts.skew);
+            for (uint64_t i = 0; i < npages; i++) {
+                order.push_back(pages[zipf.sample(random) - 1]);
+            }
+            break;
+        }
+    }
+    return order;
+}
+
+PageOrders::PageOrders(const PatternOptions &pattern, off_t filesize, off_t chunk_size, off_t meta_chunk_size) {
+    if (pattern.pattern == PATTERN_SEQUENTIAL) {
+        return;
+    }
+    if (meta_chunk_size <= 0) {
+        meta_chunk_size = filesize;
+    }
+    for (off_t meta = 0; meta < filesize; meta += meta_chunk_size) {
+        off_t meta_end = filesize - meta > meta_chunk_size ? meta + meta_chunk_size : filesize;
+        for (off_t offset = meta; offset < meta_end; offset += chunk_size) {
+            off_t size = meta_end - offset > chunk_size ? chunk_size : meta_end - offset;
+            uint64_t npages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+            offsets.push_back(offset);
+            orders.emplace_back(new std::vector<uint32_t>(page_order(pattern, npages, orders.size())));
+        }
+    }
+}
+
+PageOrder PageOrders::of(off_t offset) const {
+    // Copy backends can complete chunks out of order,
+    // so they are found by offset rather than id
+    std::vector<off_t>::const_iterator it = std::lower_bound(offsets.begin(), offsets.end(), offset);
+    if (it == offsets.end() || *it != offset) {
+        return NULL;
+    }
+    return orders[it - offsets.begin()];
+}
@@ -0,0 +1,60 @@
+#ifndef COMMON_ACCESS_PATTERN_H
+#define COMMON_ACCESS_PATTERN_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <sys/types.h>
+
+// Order in which the pages of a region are visited
+enum Pattern {
+    PATTERN_SEQUENTIAL,
+    // Every page once, in a random permutation
+    PATTERN_RANDOM,
+    // Every page once: 0, stride, 2 * stride, ..., then 1, 1 + stride, ...
+    PATTERN_STRIDED,
+    // As many visits as pages, drawn from a Zipf distribution of the
+    // given skew, so hot pages are visited many times and cold ones never
+    PATTERN_ZIPFIAN,
+};
+
+bool parse_pattern(const char *name, Pattern &pattern);
+const char *pattern_name(Pattern pattern);
+
+struct PatternOptions {
+    Pattern pattern = PATTERN_SEQUENTIAL;
+    uint64_t seed = 1;
+    // In pages
+    uint64_t stride = 8;
+    // Exponent of the Zipf distribution, any value above 0
+    double skew = 0.99;
+};
+
+// Returns the page indices of a region of npages in visiting order. The
+// same options and region give the same order on every run and machine:
+// the generator is seeded from seed and region, and does not depend on
+// the standard library's distributions.
+std::vector<uint32_t> page_order(const PatternOptions &opts, uint64_t npages, uint64_t region);
+
+typedef std::shared_ptr<const std::vector<uint32_t> > PageOrder;
+
+// Visiting order of the pages of every chunk of a file, drawn before a
+// run so that generating them is not timed. Chunks are cut from
+// metachunks of meta_chunk_size (the whole file if 0), as ChunkSource
+// does; each is its own region of the pattern, numbered by its position
+// in the file.
+class PageOrders {
+public:
+    PageOrders(const PatternOptions &pattern, off_t filesize, off_t chunk_size, off_t meta_chunk_size = 0);
+
+    // Order of the pages of the chunk at offset, NULL for the
+    // sequential pattern
+    PageOrder of(off_t offset) const;
+
+private:
+    std::vector<off_t> offsets;
+    std::vector<PageOrder> orders;
+};
+
+#endif // COMMON_ACCESS_PATTERN_H
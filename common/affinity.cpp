@@ -0,0 +1,192 @@
+#include "affinity.h"
+#include "report.h"
+#include "util.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <numa.h>
+#include <numaif.h>
+
+static const char *const affinity_names[] = {
+    "none",
+    "compact",
+    "scatter",
+    "numa",
+};
+
+bool parse_affinity(const char *name, Affinity &affinity) {
+    for (int i = 0; i <= AFFINITY_NUMA; i++) {
+        if (strcmp(name, affinity_names[i]) == 0) {
+            affinity = static_cast<Affinity>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *affinity_name(Affinity affinity) {
+    return affinity_names[affinity];
+}
+
+int current_node() {
+    if (numa_available() == -1) {
+        return 0;
+    }
+    int cpu = sched_getcpu();
+    int node = cpu == -1 ? 0 : numa_node_of_cpu(cpu);
+    return node < 0 ? 0 : node;
+}
+
+CpuPlacement::CpuPlacement(Affinity affinity, bool membind) : policy(affinity), membind(membind) {
+    int nodes = numa_available() == -1 ? 1 : numa_max_node() + 1;
+    node_cpus.resize(nodes);
+
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) {
+            continue;
+        }
+        int node = nodes > 1 ? numa_node_of_cpu(cpu) : 0;
+        if (node < 0 || node >= nodes) node = 0;
+        node_cpus[node].push_back(cpu);
+    }
+    // Nodes without any allowed CPU cannot take workers
+    for (int n = 0; n < nodes; n++) {
+        if (!node_cpus[n].empty()) {
+            cpu_nodes.push_back(n);
+        }
+    }
+
+    // Compact goes through the nodes in order, scatter takes
+    // the next CPU of each node in turn
+    if (policy == AFFINITY_SCATTER) {
+        for (size_t i = 0; cpus.size() < (size_t)CPU_COUNT(&allowed); i++) {
+            for (int n : cpu_nodes) {
+                if (i < node_cpus[n].size()) {
+                    cpus.push_back(node_cpus[n][i]);
+                    cpu_node.push_back(n);
+                }
+            }
+        }
+    } else {
+        for (int n : cpu_nodes) {
+            for (int cpu : node_cpus[n]) {
+                cpus.push_back(cpu);
+                cpu_node.push_back(n);
+            }
+        }
+    }
+    if (cpus.empty()) {
+        policy = AFFINITY_NONE;
+    }
+}
+
+Affinity CpuPlacement::affinity() const {
+    return policy;
+}
+
+int CpuPlacement::nnodes() const {
+    return cpu_nodes.size();
+}
+
+int CpuPlacement::node_of(int index) const {
+    if (policy == AFFINITY_NUMA) {
+        return cpu_nodes[index % cpu_nodes.size()];
+    }
+    return cpu_node[index % cpus.size()];
+}
+
+bool CpuPlacement::pin(int index) const {
+    if (policy == AFFINITY_NONE) {
+        return true;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    int node = node_of(index);
+    if (policy == AFFINITY_NUMA) {
+        for (int cpu : node_cpus[node]) {
+            CPU_SET(cpu, &set);
+        }
+    } else {
+        CPU_SET(cpus[index % cpus.size()], &set);
+    }
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_setaffinity_np: %s\n", strerror(ret));
+        return false;
+    }
+
+    if (membind && numa_available() != -1) {
+        numa_set_preferred(node);
+    }
+    return true;
+}
+
+void CpuPlacement::unpin() const {
+    if (policy == AFFINITY_NONE) {
+        return;
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(allowed), &allowed);
+    if (membind && numa_available() != -1) {
+        numa_set_localalloc();
+    }
+}
+
+NodeTraffic::NodeTraffic() {
+    if (numa_available() != -1) {
+        nnodes = numa_max_node() + 1;
+    }
+    bytes.reset(new std::atomic<uint64_t>[nnodes]);
+    local.reset(new std::atomic<uint64_t>[nnodes]);
+    for (int n = 0; n < nnodes; n++) {
+        bytes[n] = 0;
+        local[n] = 0;
+    }
+}
+
+void NodeTraffic::add(const void *data, size_t size) {
+    int node = current_node();
+    if (node >= nnodes) node = 0;
+    bytes[node].fetch_add(size, std::memory_order_relaxed);
+
+    int data_node = 0;
+    if (nnodes > 1 && get_mempolicy(&data_node, NULL, 0, const_cast<void *>(data),
+                MPOL_F_NODE | MPOL_F_ADDR) == -1) {
+        return;
+    }
+    if (data_node == node) {
+        local[node].fetch_add(size, std::memory_order_relaxed);
+    }
+}
+
+void NodeTraffic::print(timespec elapsed) const {
+    double time = to_seconds(elapsed);
+    for (int n = 0; n < nnodes; n++) {
+        uint64_t b = bytes[n].load();
+        if (b == 0) {
+            continue;
+        }
+        printf("Node %d bandwidth (MB/s): %f, %.1f%% local\n", n,
+                ((double)b / time) / (double)BYTES_IN_MBYTE, 100.0 * local[n].load() / b);
+    }
+}
+
+void NodeTraffic::report(Report &r, timespec elapsed) const {
+    double time = to_seconds(elapsed);
+    for (int n = 0; n < nnodes; n++) {
+        uint64_t b = bytes[n].load();
+        if (b == 0) {
+            continue;
+        }
+        Report::Section &s = r.row("node", n);
+        s.set("bytes", (unsigned long)b);
+        s.set("bandwidth_mbps", ((double)b / time) / (double)BYTES_IN_MBYTE);
+        s.set("local_pct", 100.0 * local[n].load() / b);
+    }
+}
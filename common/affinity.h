@@ -0,0 +1,91 @@
+#ifndef COMMON_AFFINITY_H
+#define COMMON_AFFINITY_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <sched.h>
+#include <time.h>
+
+class Report;
+
+enum Affinity {
+    // Threads float wherever the scheduler puts them
+    AFFINITY_NONE,
+    // Worker i on the i-th allowed CPU, filling a node before the next
+    AFFINITY_COMPACT,
+    // Workers spread round-robin over the nodes, one CPU each
+    AFFINITY_SCATTER,
+    // Workers spread round-robin over the nodes, free to move between
+    // the CPUs of their node
+    AFFINITY_NUMA,
+};
+
+// Returns false if name is not a known policy
+bool parse_affinity(const char *name, Affinity &affinity);
+const char *affinity_name(Affinity affinity);
+
+// NUMA node the calling thread runs on, 0 without NUMA support
+int current_node();
+
+// Where workers go, over the CPUs the process was allowed to run on when
+// the placement was created. Workers are numbered from 0 by the caller
+// and pin themselves with pin(). With membind, a pinned worker also
+// prefers memory from its own node, so that the page cache and buffers
+// it first touches are local to it.
+class CpuPlacement {
+public:
+    CpuPlacement(Affinity affinity, bool membind);
+
+    Affinity affinity() const;
+    // Nodes with CPUs the process may use
+    int nnodes() const;
+    // Node worker index ends up on
+    int node_of(int index) const;
+    // Pins the calling thread as worker index. Does nothing with
+    // AFFINITY_NONE, returns false if the kernel refused.
+    bool pin(int index) const;
+    // Lets the calling thread run on all the allowed CPUs again,
+    // allocating memory locally
+    void unpin() const;
+
+private:
+    Affinity policy;
+    bool membind;
+    cpu_set_t allowed;
+    // Allowed CPUs, in the order workers get them, with their node
+    std::vector<int> cpus;
+    std::vector<int> cpu_node;
+    // Allowed CPUs of each node, and the nodes that have some
+    std::vector<std::vector<int> > node_cpus;
+    std::vector<int> cpu_nodes;
+};
+
+// Bytes processed by workers on each NUMA node, and how many of those
+// were in memory on the same node. Workers call add() from any thread
+// once done with a piece of data. Each call costs a get_mempolicy() and
+// a sched_getcpu(), so only track traffic when placement matters.
+class NodeTraffic {
+public:
+    NodeTraffic();
+
+    // Looks up the node of the page at data, so data must be resident.
+    // The whole range is counted on that node: an approximation when
+    // its pages are spread over several nodes.
+    void add(const void *data, size_t size);
+
+    // One line per node that did some work, bandwidth over elapsed
+    void print(timespec elapsed) const;
+    // Same, as a "node" table
+    void report(Report &r, timespec elapsed) const;
+
+private:
+    int nnodes = 1;
+    std::unique_ptr<std::atomic<uint64_t>[]> bytes;
+    std::unique_ptr<std::atomic<uint64_t>[]> local;
+};
+
+#endif // COMMON_AFFINITY_H
@@ -0,0 +1,210 @@
+#include "buffer_pool.h"
+#include "report.h"
+#include "util.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include <sched.h>
+#include <sys/mman.h>
+
+#include <numa.h>
+
+static const uint64_t INDEX_MASK = 0xffffffff;
+
+BufferPool::BufferPool(int nbuffers, size_t size, bool huge_pages)
+    : nbuffers(nbuffers), size(size), huge_pages(huge_pages), next(new std::atomic<uint32_t>[nbuffers]),
+      buffer_node(nbuffers), in_use(0), high_water(0), hits(0), remote(0), misses(0),
+      waiters(0) {
+    mapped = round_up(nbuffers * size, huge_pages ? huge_page_size() : system_page_size());
+
+    // Reserved huge pages first, transparent huge pages otherwise
+    void *p = MAP_FAILED;
+    if (huge_pages) {
+        p = mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        hugetlb = p != MAP_FAILED;
+    }
+    if (p == MAP_FAILED) {
+        p = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            fprintf(stderr, "Error: cannot allocate %d buffers of %zu bytes.\n", nbuffers, size);
+            exit(EXIT_FAILURE);
+        }
+        // Without huge pages, keep THP set to "always" out of the comparison
+        madvise(p, mapped, huge_pages ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+    }
+    buffers = static_cast<uint8_t*>(p);
+
+    if (numa_available() != -1) {
+        nnodes = numa_max_node() + 1;
+    }
+    void *aligned;
+    if (posix_memalign(&aligned, alignof(FreeList), nnodes * sizeof(FreeList)) != 0) {
+        fprintf(stderr, "Error: cannot allocate %d free lists.\n", nnodes);
+        exit(EXIT_FAILURE);
+    }
+    lists = static_cast<FreeList*>(aligned);
+    for (int n = 0; n < nnodes; n++) {
+        new (&lists[n]) FreeList();
+        lists[n].head = 0;
+    }
+
+    // Give each node a contiguous share of the buffers, placed on its
+    // memory before anything touches it
+    int per_node = (nbuffers + nnodes - 1) / nnodes;
+    for (int n = 0; n < nnodes; n++) {
+        int first = n * per_node;
+        int last = first + per_node > nbuffers ? nbuffers : first + per_node;
+        if (first >= last) {
+            break;
+        }
+        if (nnodes > 1) {
+            numa_tonode_memory(data(first), (last - first) * size, n);
+        }
+        for (int i = last - 1; i >= first; i--) {
+            buffer_node[i] = n;
+            push(n, i);
+        }
+    }
+}
+
+BufferPool::~BufferPool() {
+    if (buffers) {
+        munmap(buffers, mapped);
+    }
+    for (int n = 0; n < nnodes; n++) {
+        lists[n].~FreeList();
+    }
+    free(lists);
+}
+
+void BufferPool::free_buffers() {
+    if (in_use > 0) {
+        fprintf(stderr, "Error: freeing a pool with %d buffers in use.\n", in_use.load());
+        exit(EXIT_FAILURE);
+    }
+    if (buffers) {
+        munmap(buffers, mapped);
+        buffers = NULL;
+    }
+}
+
+int BufferPool::count() const {
+    return nbuffers;
+}
+
+size_t BufferPool::buffer_size() const {
+    return size;
+}
+
+uint8_t *BufferPool::data(int buffer) const {
+    return buffers + buffer * size;
+}
+
+int BufferPool::pop(int node) {
+    std::atomic<uint64_t> &head = lists[node].head;
+    uint64_t old = head.load();
+    while (true) {
+        uint32_t top = old & INDEX_MASK;
+        if (top == 0) {
+            return -1;
+        }
+        int buffer = top - 1;
+        uint64_t updated = ((old >> 32) + 1) << 32 | next[buffer].load();
+        if (head.compare_exchange_weak(old, updated)) {
+            return buffer;
+        }
+    }
+}
+
+void BufferPool::push(int node, int buffer) {
+    std::atomic<uint64_t> &head = lists[node].head;
+    uint64_t old = head.load();
+    while (true) {
+        next[buffer].store(old & INDEX_MASK);
+        uint64_t updated = ((old >> 32) + 1) << 32 | (uint64_t)(buffer + 1);
+        if (head.compare_exchange_weak(old, updated)) {
+            return;
+        }
+    }
+}
+
+int BufferPool::try_acquire(bool count) {
+    int local = 0;
+    if (nnodes > 1) {
+        int cpu = sched_getcpu();
+        local = cpu == -1 ? 0 : numa_node_of_cpu(cpu);
+        if (local < 0 || local >= nnodes) local = 0;
+    }
+
+    int buffer = pop(local);
+    if (buffer != -1) {
+        if (count) hits.fetch_add(1, std::memory_order_relaxed);
+        return buffer;
+    }
+    for (int n = 0; n < nnodes; n++) {
+        if (n == local) continue;
+        buffer = pop(n);
+        if (buffer != -1) {
+            if (count) remote.fetch_add(1, std::memory_order_relaxed);
+            return buffer;
+        }
+    }
+    return -1;
+}
+
+int BufferPool::acquire(bool wait) {
+    int buffer = try_acquire(true);
+    if (buffer == -1) {
+        misses.fetch_add(1, std::memory_order_relaxed);
+        if (!wait) {
+            return -1;
+        }
+        // Slow path: sleep until release() hands a buffer back
+        waiters++;
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this, &buffer] { return (buffer = try_acquire(false)) != -1; });
+        waiters--;
+    }
+
+    int used = ++in_use;
+    int peak = high_water.load(std::memory_order_relaxed);
+    while (used > peak && !high_water.compare_exchange_weak(peak, used)) {
+    }
+    return buffer;
+}
+
+void BufferPool::release(int buffer) {
+    in_use--;
+    push(buffer_node[buffer], buffer);
+    if (waiters.load() > 0) {
+        std::lock_guard<std::mutex> lock(mutex);
+        cv.notify_all();
+    }
+}
+
+std::shared_ptr<void> BufferPool::handle(int buffer) {
+    return std::shared_ptr<void>(data(buffer), [this, buffer](void *) { release(buffer); });
+}
+
+void BufferPool::print_stats() const {
+    printf("Buffer pool: %d x %zu bytes on %d node(s), %s pages\n",
+            nbuffers, size, nnodes, hugetlb ? "hugetlb" : huge_pages ? "transparent huge" : "base");
+    printf("Buffer pool hits: %lu remote: %lu misses: %lu high-water: %d\n",
+            hits.load(), remote.load(), misses.load(), high_water.load());
+}
+
+void BufferPool::report_stats(Report &r) const {
+    Report::Section &s = r.section("source");
+    s.set("pool_buffers", nbuffers);
+    s.set("pool_buffer_size", (unsigned long)size);
+    s.set("pool_nodes", nnodes);
+    s.set("pool_huge_pages", huge_pages);
+    s.set("pool_hugetlb", hugetlb);
+    s.set("pool_hits", (unsigned long)hits.load());
+    s.set("pool_remote", (unsigned long)remote.load());
+    s.set("pool_misses", (unsigned long)misses.load());
+    s.set("pool_high_water", high_water.load());
+}
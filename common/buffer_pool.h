@@ -0,0 +1,82 @@
+#ifndef COMMON_BUFFER_POOL_H
+#define COMMON_BUFFER_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+class Report;
+
+// Fixed set of page-aligned buffers of the same size, spread over the
+// NUMA nodes. Each node keeps a lock-free free list; acquire() prefers
+// buffers local to the caller. With huge_pages, buffers are backed by
+// reserved huge pages when possible and transparent ones otherwise;
+// without, they are kept on base pages.
+class BufferPool {
+public:
+    BufferPool(int nbuffers, size_t size, bool huge_pages);
+    ~BufferPool();
+
+    int count() const;
+    size_t buffer_size() const;
+    uint8_t *data(int buffer) const;
+
+    // Returns a free buffer, or -1 if there is none and wait is false
+    int acquire(bool wait);
+    void release(int buffer);
+    // Handle that releases the buffer once the last copy goes away
+    std::shared_ptr<void> handle(int buffer);
+    // Unmaps the buffers, keeping the statistics. Exits if one is still
+    // in use.
+    void free_buffers();
+
+    // Prints hits (local node), remote (other node), misses (pool
+    // empty) and the high-water mark of buffers in use
+    void print_stats() const;
+    // Same statistics, in the "source" section of a report
+    void report_stats(Report &r) const;
+
+private:
+    // Treiber stack of buffer indices. The head packs a generation
+    // count with the index + 1 of the top buffer to avoid ABA. Lists
+    // are allocated on cache lines of their own, new does not honour
+    // the alignment before C++17.
+    struct FreeList {
+        alignas(64) std::atomic<uint64_t> head;
+    };
+
+    int pop(int node);
+    // Local node first, then the others. Hits and remote
+    // acquisitions are only counted when count is set.
+    int try_acquire(bool count);
+    void push(int node, int buffer);
+
+    int nbuffers;
+    size_t size;
+    size_t mapped = 0;
+    bool huge_pages;
+    bool hugetlb = false;
+    uint8_t *buffers = NULL;
+
+    int nnodes = 1;
+    FreeList *lists = NULL;
+    std::unique_ptr<std::atomic<uint32_t>[]> next;
+    std::vector<int> buffer_node;
+
+    std::atomic<int> in_use;
+    std::atomic<int> high_water;
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> remote;
+    std::atomic<uint64_t> misses;
+
+    // Only used to sleep when the pool is empty
+    std::atomic<int> waiters;
+    std::mutex mutex;
+    std::condition_variable cv;
+};
+
+#endif // COMMON_BUFFER_POOL_H
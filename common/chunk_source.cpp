@@ -0,0 +1,168 @@
+#include "chunk_source.h"
+#include "iotrace.h"
+#include "report.h"
+#include "sources.h"
+#include "util.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char *const backend_names[] = {
+    "mmap",
+    "pread",
+    "direct",
+    "splice",
+    "uring",
+};
+
+bool parse_backend(const char *name, Backend &backend) {
+    for (int i = 0; i <= BACKEND_URING; i++) {
+        if (strcmp(name, backend_names[i]) == 0) {
+            backend = static_cast<Backend>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *backend_name(Backend backend) {
+    return backend_names[backend];
+}
+
+ChunkSource::ChunkSource(off_t filesize) : size(filesize) {
+}
+
+ChunkSource::~ChunkSource() {
+}
+
+bool ChunkSource::next(Chunk &c) {
+    timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool ret = read_next(c);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    stall += to_seconds(time_diff(start, end));
+    if (ret) {
+        c.id = dispatched++;
+        iotrace(chunk_dispatch, c.id, c.offset, c.size);
+    }
+    return ret;
+}
+
+off_t ChunkSource::filesize() const {
+    return size;
+}
+
+double ChunkSource::stall_time() const {
+    return stall;
+}
+
+void ChunkSource::print_stats() const {
+}
+
+void ChunkSource::report_stats(Report &) const {
+}
+
+void ChunkSource::finish() {
+}
+
+ChunkSource *make_chunk_source(const std::string &filename, const SourceOptions &opts) {
+    int flags = O_RDONLY;
+    if (opts.backend == BACKEND_DIRECT || opts.backend == BACKEND_URING) {
+        flags |= O_DIRECT;
+    }
+
+    int fd = open(filename.c_str(), flags);
+    if (fd == -1) {
+        fprintf(stderr, "Error: cannot open file %s: %s\n", filename.c_str(), strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    off_t filesize = get_filesize(fd);
+    if (filesize == -1) {
+        fprintf(stderr, "Error: cannot get file size.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    switch (opts.backend) {
+        case BACKEND_MMAP:
+            return make_mmap_source(fd, filesize, opts);
+        case BACKEND_PREAD:
+        case BACKEND_DIRECT:
+            return make_pread_source(fd, filesize, opts);
+        case BACKEND_SPLICE:
+            return make_splice_source(fd, filesize, opts);
+        case BACKEND_URING:
+            return make_uring_source(fd, filesize, opts);
+    }
+    return NULL;
+}
+
+static off_t total_size(const std::vector<std::unique_ptr<ChunkSource> > &sources) {
+    off_t size = 0;
+    for (const std::unique_ptr<ChunkSource> &source : sources) {
+        size += source->filesize();
+    }
+    return size;
+}
+
+MultiSource::MultiSource(std::vector<std::unique_ptr<ChunkSource> > sources)
+    : ChunkSource(total_size(sources)), sources(std::move(sources)) {
+    for (size_t i = 0; i < this->sources.size(); i++) {
+        active.push_back(i);
+    }
+}
+
+int MultiSource::count() const {
+    return sources.size();
+}
+
+const ChunkSource &MultiSource::file(int i) const {
+    return *sources[i];
+}
+
+double MultiSource::stall_time() const {
+    double total = stall;
+    for (const std::unique_ptr<ChunkSource> &source : sources) {
+        total += source->stall_time();
+    }
+    return total;
+}
+
+bool MultiSource::read_next(Chunk &c) {
+    while (!active.empty()) {
+        if (turn >= active.size()) {
+            turn = 0;
+        }
+        int i = active[turn];
+        // Straight to the backend, the stall is counted here
+        if (sources[i]->read_next(c)) {
+            c.file = i;
+            turn++;
+            return true;
+        }
+        active.erase(active.begin() + turn);
+    }
+    return false;
+}
+
+void MultiSource::print_stats() const {
+    for (size_t i = 0; i < sources.size(); i++) {
+        printf("File %zu:\n", i);
+        sources[i]->print_stats();
+    }
+}
+
+void MultiSource::report_stats(Report &r) const {
+    r.section("source").set("files", (int)sources.size());
+}
+
+void MultiSource::finish() {
+    for (std::unique_ptr<ChunkSource> &source : sources) {
+        source->finish();
+    }
+}
@@ -0,0 +1,140 @@
+#ifndef COMMON_CHUNK_SOURCE_H
+#define COMMON_CHUNK_SOURCE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+class Report;
+class ResidencyTracker;
+class StageHistograms;
+
+enum Backend {
+    BACKEND_MMAP,
+    BACKEND_PREAD,
+    BACKEND_DIRECT,
+    BACKEND_SPLICE,
+    BACKEND_URING,
+};
+
+// Returns false if name is not a known backend
+bool parse_backend(const char *name, Backend &backend);
+const char *backend_name(Backend backend);
+
+// A piece of the file, ready to be processed
+struct Chunk {
+    // Sequence number, in the order chunks were handed out
+    uint64_t id = 0;
+    // Index of the file the chunk is from, with many files
+    int file = 0;
+    uint8_t *start = NULL;
+    off_t offset = 0;
+    off_t size = 0;
+    // Keeps the memory backing the chunk (a mapping or a read buffer)
+    // alive while the chunk is in flight; reset it once done with the data
+    std::shared_ptr<void> owner;
+};
+
+struct SourceOptions {
+    Backend backend = BACKEND_MMAP;
+    off_t chunk_size = 0;
+    // mmap: size of each mapping, split into chunks
+    off_t meta_chunk_size = 0;
+    // mmap: maximum number of mappings alive at once
+    int window = 0;
+    // mmap: number of mappings prepared ahead by a helper thread
+    int prefetch = 0;
+    // mmap: MAP_POPULATE the mappings
+    bool prefault = false;
+    // mmap: advice given to madvise for each mapping
+    int advice = 0;
+    // mmap: map on huge page boundaries and ask for transparent huge
+    // pages, copy backends: back the read buffers with huge pages
+    bool huge_pages = false;
+    // mmap: read ahead and prefault each chunk from the thread that
+    // takes it rather than when mapping, so that its page cache is
+    // allocated by (and with the memory policy of) its consumer
+    bool consumer_faults = false;
+    // uring: number of reads in flight
+    int queue_depth = 0;
+    // Maximum number of chunks the consumer holds at once
+    int held = 1;
+    // If set, the time taken to map or read each metachunk or chunk is
+    // recorded in this stage
+    StageHistograms *latency = NULL;
+    int latency_stage = 0;
+    // mmap: if set, residency of each metachunk is sampled in it
+    ResidencyTracker *residency = NULL;
+};
+
+// Hands out the chunks of a file in order. next() must not be called
+// concurrently, but chunks can be released from any thread.
+class ChunkSource {
+public:
+    virtual ~ChunkSource();
+
+    // Returns false once the whole file has been handed out
+    bool next(Chunk &c);
+    off_t filesize() const;
+    // Time spent inside next() waiting for data
+    virtual double stall_time() const;
+    // Prints backend-specific statistics
+    virtual void print_stats() const;
+    // Same statistics, in the "source" section of a report
+    virtual void report_stats(Report &r) const;
+    // Gives back the buffers and helper threads of a source read to the
+    // end, once all its chunks are released, keeping its statistics
+    virtual void finish();
+
+protected:
+    friend class MultiSource;
+
+    ChunkSource(off_t filesize);
+    virtual bool read_next(Chunk &c) = 0;
+
+    off_t size;
+    double stall = 0;
+    uint64_t dispatched = 0;
+};
+
+// What the mmap backend does to each chunk with consumer_faults: faults
+// it in from the calling thread with prefault, else only starts its
+// read-ahead from there. For consumers that split a mapped chunk between
+// threads and have each fault in its own share.
+void fault_in(uint8_t *start, off_t size, bool prefault);
+
+// Opens filename with the backend given in opts, exits on error
+ChunkSource *make_chunk_source(const std::string &filename, const SourceOptions &opts);
+
+// Chunks of many files, each read through its own source. Interleaved,
+// next() takes one chunk from each file in turn, like a reader merging
+// the streams of a trace. The sources can also be read on their own
+// (one pipeline per file) and handed over for their statistics only.
+class MultiSource : public ChunkSource {
+public:
+    MultiSource(std::vector<std::unique_ptr<ChunkSource> > sources);
+
+    int count() const;
+    const ChunkSource &file(int i) const;
+    // Includes the stalls of sources read on their own
+    double stall_time() const;
+    // Statistics of each file in turn
+    void print_stats() const;
+    // Number of files only, per-file statistics come from the pipeline
+    void report_stats(Report &r) const;
+    void finish();
+
+protected:
+    bool read_next(Chunk &c);
+
+private:
+    std::vector<std::unique_ptr<ChunkSource> > sources;
+    // Files not read to the end yet, in turn order
+    std::vector<int> active;
+    size_t turn = 0;
+};
+
+#endif // COMMON_CHUNK_SOURCE_H
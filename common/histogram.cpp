@@ -0,0 +1,146 @@
+#include "histogram.h"
+#include "report.h"
+#include "util.h"
+
+#include <cstdio>
+
+#include <time.h>
+
+double tsc_ticks_per_nsec() {
+    static double ticks_per_nsec = 0;
+    if (ticks_per_nsec == 0) {
+        timespec start, end;
+        timespec interval = { 0, 10 * NSECS_IN_MSEC };
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        uint64_t tsc_start = read_tsc();
+        nanosleep(&interval, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        uint64_t tsc_end = read_tsc();
+        timespec diff = time_diff(start, end);
+        ticks_per_nsec = (double)(tsc_end - tsc_start) / (diff.tv_sec * (double)NSECS_IN_SEC + diff.tv_nsec);
+    }
+    return ticks_per_nsec;
+}
+
+LatencyHistogram::LatencyHistogram() : counts(BUCKETS) {
+}
+
+int LatencyHistogram::index(uint64_t value) {
+    if (value < SUB_BUCKETS) {
+        return value;
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    int shift = exponent - SUB_BUCKET_BITS;
+    // value >> shift is in [SUB_BUCKETS, 2 * SUB_BUCKETS)
+    return (shift + 1) * SUB_BUCKETS + (value >> shift) - SUB_BUCKETS;
+}
+
+uint64_t LatencyHistogram::lowest(int index) {
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+    int shift = index / SUB_BUCKETS - 1;
+    return (uint64_t)(index % SUB_BUCKETS + SUB_BUCKETS) << shift;
+}
+
+uint64_t LatencyHistogram::highest(int index) {
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+    int shift = index / SUB_BUCKETS - 1;
+    return lowest(index) + ((uint64_t)1 << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t value) {
+    counts[index(value)]++;
+    total++;
+    sum += value;
+    if (value > maximum) maximum = value;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other) {
+    for (int i = 0; i < BUCKETS; i++) {
+        counts[i] += other.counts[i];
+    }
+    total += other.total;
+    sum += other.sum;
+    if (other.maximum > maximum) maximum = other.maximum;
+}
+
+uint64_t LatencyHistogram::count() const {
+    return total;
+}
+
+uint64_t LatencyHistogram::max() const {
+    return maximum;
+}
+
+double LatencyHistogram::mean() const {
+    return total > 0 ? (double)sum / (double)total : 0;
+}
+
+uint64_t LatencyHistogram::percentile(double fraction) const {
+    uint64_t target = fraction * total;
+    if (target == 0) target = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= target) {
+            uint64_t value = highest(i);
+            return value < maximum ? value : maximum;
+        }
+    }
+    return maximum;
+}
+
+StageHistograms::ThreadHistograms::ThreadHistograms(size_t nstages) : stages(nstages) {
+}
+
+StageHistograms::StageHistograms(const std::vector<std::string> &stages) : stages(stages) {
+}
+
+void StageHistograms::record(int stage, uint64_t ticks) {
+    threads.local(stages.size()).stages[stage].record(ticks);
+}
+
+LatencyHistogram StageHistograms::merged(int stage) const {
+    LatencyHistogram ret;
+    for (const ThreadHistograms *t : threads.all()) {
+        ret.merge(t->stages[stage]);
+    }
+    return ret;
+}
+
+static double to_nsec(double ticks) {
+    return ticks / tsc_ticks_per_nsec();
+}
+
+void StageHistograms::print_text() const {
+    for (size_t s = 0; s < stages.size(); s++) {
+        LatencyHistogram h = merged(s);
+        if (h.count() == 0) {
+            continue;
+        }
+        printf("Latency %s (ns): count:%lu mean:%.0f p50:%.0f p99:%.0f p99.9:%.0f max:%.0f\n",
+                stages[s].c_str(), h.count(), to_nsec(h.mean()),
+                to_nsec(h.percentile(0.5)), to_nsec(h.percentile(0.99)),
+                to_nsec(h.percentile(0.999)), to_nsec(h.max()));
+    }
+}
+
+void StageHistograms::report(Report &r) const {
+    Report::Section &section = r.section("latency_ns");
+    for (size_t s = 0; s < stages.size(); s++) {
+        LatencyHistogram h = merged(s);
+        if (h.count() == 0) {
+            continue;
+        }
+        const std::string &name = stages[s];
+        section.set(name + ".count", (unsigned long)h.count());
+        section.set(name + ".mean", (unsigned long)to_nsec(h.mean()));
+        section.set(name + ".p50", (unsigned long)to_nsec(h.percentile(0.5)));
+        section.set(name + ".p99", (unsigned long)to_nsec(h.percentile(0.99)));
+        section.set(name + ".p999", (unsigned long)to_nsec(h.percentile(0.999)));
+        section.set(name + ".max", (unsigned long)to_nsec(h.max()));
+    }
+}
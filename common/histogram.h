@@ -0,0 +1,78 @@
+#ifndef COMMON_HISTOGRAM_H
+#define COMMON_HISTOGRAM_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <x86intrin.h>
+
+#include "per_thread.h"
+
+class Report;
+
+static inline uint64_t read_tsc() {
+    return __rdtsc();
+}
+
+// TSC ticks per nanosecond, measured against CLOCK_MONOTONIC on first use
+double tsc_ticks_per_nsec();
+
+// Log-linear histogram, in the spirit of HdrHistogram: values are
+// bucketed by power of two, and each power of two is split in
+// 2^SUB_BUCKET_BITS linear sub-buckets, so any recorded value is known
+// within about 3%.
+class LatencyHistogram {
+public:
+    static const int SUB_BUCKET_BITS = 5;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    LatencyHistogram();
+
+    void record(uint64_t value);
+    void merge(const LatencyHistogram &other);
+
+    uint64_t count() const;
+    uint64_t max() const;
+    double mean() const;
+    // Smallest value with at least fraction of the samples at or below it
+    uint64_t percentile(double fraction) const;
+
+private:
+    static int index(uint64_t value);
+    static uint64_t lowest(int index);
+    static uint64_t highest(int index);
+
+    std::vector<uint64_t> counts;
+    uint64_t total = 0;
+    uint64_t sum = 0;
+    uint64_t maximum = 0;
+};
+
+// One LatencyHistogram per thread and per stage, recorded without
+// synchronization and merged when printed. Values are TSC ticks and
+// printed in nanoseconds.
+class StageHistograms {
+public:
+    StageHistograms(const std::vector<std::string> &stages);
+
+    void record(int stage, uint64_t ticks);
+    LatencyHistogram merged(int stage) const;
+
+    // p50, p99, p99.9 and max of every stage that has samples
+    void print_text() const;
+    // Same values, in the "latency_ns" section of a report
+    void report(Report &r) const;
+
+private:
+    struct ThreadHistograms {
+        ThreadHistograms(size_t nstages);
+        std::vector<LatencyHistogram> stages;
+    };
+
+    std::vector<std::string> stages;
+    PerThread<ThreadHistograms> threads;
+};
+
+#endif // COMMON_HISTOGRAM_H
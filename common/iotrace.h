@@ -0,0 +1,31 @@
+#ifndef COMMON_IOTRACE_H
+#define COMMON_IOTRACE_H
+
+// Tracepoints of the iotrace provider. They only exist when built with
+// IOTRACE defined (make IOTRACE=1); otherwise iotrace() expands to
+// nothing and its arguments are not evaluated.
+//
+//     iotrace(chunk_dispatch, c.id, c.offset, c.size);
+
+#ifdef IOTRACE
+
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "iotrace_tp.h"
+
+#define iotrace(...) tracepoint(iotrace, __VA_ARGS__)
+
+// Kernel thread id of the caller, cached
+static inline int iotrace_tid() {
+    static thread_local int tid = syscall(SYS_gettid);
+    return tid;
+}
+
+#else
+
+#define iotrace(...) do {} while (0)
+
+#endif // IOTRACE
+
+#endif // COMMON_IOTRACE_H
@@ -0,0 +1,6 @@
+// Instantiates the iotrace tracepoint provider
+#ifdef IOTRACE
+#define TRACEPOINT_DEFINE
+#define TRACEPOINT_CREATE_PROBES
+#include "iotrace_tp.h"
+#endif
@@ -0,0 +1,70 @@
+#undef TRACEPOINT_PROVIDER
+#define TRACEPOINT_PROVIDER iotrace
+
+#undef TRACEPOINT_INCLUDE_FILE
+#define TRACEPOINT_INCLUDE_FILE ./iotrace_tp.h
+
+#if !defined(_IOTRACE_TP_H) || defined(TRACEPOINT_HEADER_MULTI_READ)
+#define _IOTRACE_TP_H
+
+#include <lttng/tracepoint.h>
+#include <stdint.h>
+
+TRACEPOINT_EVENT(
+    iotrace,
+    metachunk_map,
+    TP_ARGS(uint64_t, offset, uint64_t, size, uint64_t, duration),
+    TP_FIELDS(
+        ctf_integer_hex(uint64_t, offset, offset)
+        ctf_integer(uint64_t, size, size)
+        ctf_integer(uint64_t, duration, duration))
+)
+
+TRACEPOINT_EVENT(
+    iotrace,
+    metachunk_unmap,
+    TP_ARGS(uint64_t, offset, uint64_t, size, uint64_t, duration),
+    TP_FIELDS(
+        ctf_integer_hex(uint64_t, offset, offset)
+        ctf_integer(uint64_t, size, size)
+        ctf_integer(uint64_t, duration, duration))
+)
+
+TRACEPOINT_EVENT(
+    iotrace,
+    chunk_dispatch,
+    TP_ARGS(uint64_t, chunk, uint64_t, offset, uint64_t, size),
+    TP_FIELDS(
+        ctf_integer(uint64_t, chunk, chunk)
+        ctf_integer_hex(uint64_t, offset, offset)
+        ctf_integer(uint64_t, size, size))
+)
+
+TRACEPOINT_EVENT(
+    iotrace,
+    process_begin,
+    TP_ARGS(uint64_t, chunk, int, tid),
+    TP_FIELDS(
+        ctf_integer(uint64_t, chunk, chunk)
+        ctf_integer(int, tid, tid))
+)
+
+TRACEPOINT_EVENT(
+    iotrace,
+    process_end,
+    TP_ARGS(uint64_t, chunk, int, tid),
+    TP_FIELDS(
+        ctf_integer(uint64_t, chunk, chunk)
+        ctf_integer(int, tid, tid))
+)
+
+TRACEPOINT_EVENT(
+    iotrace,
+    output_retire,
+    TP_ARGS(uint64_t, chunk),
+    TP_FIELDS(
+        ctf_integer(uint64_t, chunk, chunk))
+)
+
+#endif /* _IOTRACE_TP_H */
+#include <lttng/tracepoint-event.h>
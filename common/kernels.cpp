@@ -0,0 +1,235 @@
+#include "kernels.h"
+#include "report.h"
+#include "util.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <immintrin.h>
+
+static const char *const kernel_names[] = {
+    "touch",
+    "crc32c",
+    "histogram",
+    "scan",
+};
+
+static const char *const isa_names[] = {
+    "scalar",
+    "sse2",
+    "sse4.2",
+    "avx2",
+    "avx512",
+};
+
+static const uint8_t SCAN_BYTE = '\n';
+
+bool parse_kernel(const char *name, Kernel &kernel) {
+    for (int i = 0; i <= KERNEL_SCAN; i++) {
+        if (strcmp(name, kernel_names[i]) == 0) {
+            kernel = static_cast<Kernel>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *kernel_name(Kernel kernel) {
+    return kernel_names[kernel];
+}
+
+bool parse_isa(const char *name, Isa &isa) {
+    for (int i = 0; i <= ISA_AVX512; i++) {
+        if (strcmp(name, isa_names[i]) == 0) {
+            isa = static_cast<Isa>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *isa_name(Isa isa) {
+    return isa_names[isa];
+}
+
+// Kernels built for AVX2 and up also use popcnt, which has its own
+// CPUID bit, so these levels require it
+Isa detect_isa() {
+    __builtin_cpu_init();
+    bool popcnt = __builtin_cpu_supports("popcnt");
+    if (popcnt && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) return ISA_AVX512;
+    if (popcnt && __builtin_cpu_supports("avx2")) return ISA_AVX2;
+    if (__builtin_cpu_supports("sse4.2")) return ISA_SSE42;
+    if (__builtin_cpu_supports("sse2")) return ISA_SSE2;
+    return ISA_SCALAR;
+}
+
+static uint64_t touch_scalar(const uint8_t *data, size_t size, int iterations) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < size; i += PAGE_SIZE) {
+        sum += data[i];
+        for (int j = 0; j < iterations; j++) {
+            sum++;
+            asm("");
+        }
+    }
+    return sum;
+}
+
+// Reflected CRC32C (Castagnoli) polynomial
+static const uint32_t CRC32C_POLY = 0x82f63b78;
+
+struct Crc32cTable {
+    uint32_t entries[256];
+    Crc32cTable() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int j = 0; j < 8; j++) {
+                crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+            }
+            entries[i] = crc;
+        }
+    }
+};
+
+static const Crc32cTable crc32c_table;
+
+static uint64_t crc32c_scalar(const uint8_t *data, size_t size, int) {
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < size; i++) {
+        crc = crc32c_table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffff;
+}
+
+__attribute__((target("sse4.2")))
+static uint64_t crc32c_sse42(const uint8_t *data, size_t size, int) {
+    uint64_t crc = 0xffffffff;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t v;
+        memcpy(&v, data + i, sizeof(v));
+        crc = _mm_crc32_u64(crc, v);
+    }
+    uint32_t crc32 = crc;
+    for (; i < size; i++) {
+        crc32 = _mm_crc32_u8(crc32, data[i]);
+    }
+    return crc32 ^ 0xffffffff;
+}
+
+// Folds the counts into one value so the work cannot be optimized away
+static uint64_t histogram_digest(const uint64_t *counts) {
+    uint64_t digest = 0;
+    for (int i = 0; i < 256; i++) {
+        digest += counts[i] * (i + 1);
+    }
+    return digest;
+}
+
+static uint64_t histogram_scalar(const uint8_t *data, size_t size, int) {
+    // Four tables so consecutive equal bytes do not serialize on
+    // the same counter
+    uint64_t counts[4][256] = {{0}};
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        counts[0][data[i]]++;
+        counts[1][data[i + 1]]++;
+        counts[2][data[i + 2]]++;
+        counts[3][data[i + 3]]++;
+    }
+    for (; i < size; i++) {
+        counts[0][data[i]]++;
+    }
+    for (int j = 0; j < 256; j++) {
+        counts[0][j] += counts[1][j] + counts[2][j] + counts[3][j];
+    }
+    return histogram_digest(counts[0]);
+}
+
+static uint64_t scan_scalar(const uint8_t *data, size_t size, int) {
+    uint64_t count = 0;
+    for (size_t i = 0; i < size; i++) {
+        count += data[i] == SCAN_BYTE;
+    }
+    return count;
+}
+
+// No popcnt here, SSE2 alone does not imply it
+__attribute__((target("sse2")))
+static uint64_t scan_sse2(const uint8_t *data, size_t size, int) {
+    uint64_t count = 0;
+    const __m128i needle = _mm_set1_epi8(SCAN_BYTE);
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)));
+    }
+    return count + scan_scalar(data + i, size - i, 0);
+}
+
+__attribute__((target("avx2,popcnt")))
+static uint64_t scan_avx2(const uint8_t *data, size_t size, int) {
+    uint64_t count = 0;
+    const __m256i needle = _mm256_set1_epi8(SCAN_BYTE);
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        count += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle)));
+    }
+    return count + scan_scalar(data + i, size - i, 0);
+}
+
+__attribute__((target("avx512f,avx512bw,popcnt")))
+static uint64_t scan_avx512(const uint8_t *data, size_t size, int) {
+    uint64_t count = 0;
+    const __m512i needle = _mm512_set1_epi8(SCAN_BYTE);
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64) {
+        __m512i v = _mm512_loadu_si512(data + i);
+        count += __builtin_popcountll(_mm512_cmpeq_epi8_mask(v, needle));
+    }
+    return count + scan_scalar(data + i, size - i, 0);
+}
+
+struct Implementation {
+    Kernel kernel;
+    Isa isa;
+    KernelFunc func;
+};
+
+// Fastest first for each kernel
+static const Implementation implementations[] = {
+    { KERNEL_TOUCH, ISA_SCALAR, touch_scalar },
+    { KERNEL_CRC32C, ISA_SSE42, crc32c_sse42 },
+    { KERNEL_CRC32C, ISA_SCALAR, crc32c_scalar },
+    { KERNEL_HISTOGRAM, ISA_SCALAR, histogram_scalar },
+    { KERNEL_SCAN, ISA_AVX512, scan_avx512 },
+    { KERNEL_SCAN, ISA_AVX2, scan_avx2 },
+    { KERNEL_SCAN, ISA_SSE2, scan_sse2 },
+    { KERNEL_SCAN, ISA_SCALAR, scan_scalar },
+};
+
+KernelFunc select_kernel(Kernel kernel, Isa max_isa, Isa &chosen) {
+    Isa supported = detect_isa();
+    for (const Implementation &impl : implementations) {
+        if (impl.kernel == kernel && impl.isa <= max_isa && impl.isa <= supported) {
+            chosen = impl.isa;
+            return impl.func;
+        }
+    }
+    return NULL;
+}
+
+void print_kernel_results(Kernel kernel, Isa isa, off_t bytes, double seconds) {
+    printf("Kernel: %s (%s)\n", kernel_name(kernel), isa_name(isa));
+    printf("Kernel throughput (GB/s): %f\n", seconds > 0 ? ((double)bytes/seconds)/(double)BYTES_IN_GBYTE : 0.0);
+}
+
+void report_kernel_results(Report &r, Kernel kernel, Isa isa, off_t bytes, double seconds) {
+    Report::Section &s = r.section("kernel");
+    s.set("kernel", kernel_name(kernel));
+    s.set("isa", isa_name(isa));
+    s.set("time_s", seconds);
+    s.set("throughput_gbps", seconds > 0 ? ((double)bytes/seconds)/(double)BYTES_IN_GBYTE : 0.0);
+}
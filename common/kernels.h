@@ -0,0 +1,52 @@
+#ifndef COMMON_KERNELS_H
+#define COMMON_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <sys/types.h>
+
+class Report;
+
+// Work done on every chunk by the benchmarks
+enum Kernel {
+    // One byte per page, then iterations increments (the original model)
+    KERNEL_TOUCH,
+    // CRC32C of the whole buffer
+    KERNEL_CRC32C,
+    // Histogram of every byte value
+    KERNEL_HISTOGRAM,
+    // Count of newline bytes, like repeated memchr
+    KERNEL_SCAN,
+};
+
+// Instruction sets, in increasing order
+enum Isa {
+    ISA_SCALAR,
+    ISA_SSE2,
+    ISA_SSE42,
+    ISA_AVX2,
+    ISA_AVX512,
+};
+
+typedef uint64_t (*KernelFunc)(const uint8_t *data, size_t size, int iterations);
+
+bool parse_kernel(const char *name, Kernel &kernel);
+const char *kernel_name(Kernel kernel);
+bool parse_isa(const char *name, Isa &isa);
+const char *isa_name(Isa isa);
+
+// Best instruction set supported by this CPU
+Isa detect_isa();
+
+// Picks the fastest implementation of kernel that needs at most max_isa
+// and that the CPU supports. The instruction set it uses goes in chosen.
+KernelFunc select_kernel(Kernel kernel, Isa max_isa, Isa &chosen);
+
+// Prints which kernel ran and how fast it went through bytes, given the
+// time spent inside it summed over all threads
+void print_kernel_results(Kernel kernel, Isa isa, off_t bytes, double seconds);
+// Same, in the "kernel" section of a report
+void report_kernel_results(Report &r, Kernel kernel, Isa isa, off_t bytes, double seconds);
+
+#endif // COMMON_KERNELS_H
@@ -0,0 +1,389 @@
+#include "sources.h"
+#include "histogram.h"
+#include "iotrace.h"
+#include "report.h"
+#include "residency.h"
+#include "util.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+struct MetaChunk {
+    uint8_t *start = NULL;
+    off_t size = 0;
+    off_t offset = 0;
+    off_t processed = 0;
+    // In the ResidencyTracker, -1 until dispatched
+    int region = -1;
+};
+
+typedef std::shared_ptr<MetaChunk> MetaChunkRef;
+
+// Bounds the number of metachunks mapped at the same time. Mappings are
+// handed out as reference-counted handles; the last reference to go away
+// unmaps the metachunk and frees its slot in the window.
+class MetaChunkWindow {
+public:
+    MetaChunkWindow(int capacity);
+    MetaChunkRef map(int fd, off_t offset, off_t size, const SourceOptions &opts);
+    int peak() const;
+    // With huge pages, metachunks for which madvise(MADV_HUGEPAGE)
+    // succeeded or failed. It succeeds on file mappings even where the
+    // filesystem never uses huge pages, so this is only what was asked.
+    int huge_advised() const;
+    int huge_advice_failed() const;
+
+private:
+    void release(MetaChunk *m, ResidencyTracker *residency);
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    int capacity;
+    int live = 0;
+    int max_live = 0;
+    std::atomic<int> advised;
+    std::atomic<int> advice_failed;
+};
+
+MetaChunkWindow::MetaChunkWindow(int capacity) : capacity(capacity), advised(0), advice_failed(0) {
+}
+
+// Maps size bytes of fd at offset. A huge page can only back the part of
+// a mapping where the address and the file offset agree modulo the huge
+// page size, so with huge_pages, a larger area is reserved, the file is
+// mapped over it at the first such address and the slack is given back.
+static uint8_t *map_file(int fd, off_t offset, off_t size, int flags, bool huge_pages) {
+    if (!huge_pages) {
+        return static_cast<uint8_t*>(mmap(NULL, size, PROT_READ, flags, fd, offset));
+    }
+
+    off_t align = huge_page_size();
+    off_t reserved = size + align;
+    void *p = mmap(NULL, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        return static_cast<uint8_t*>(MAP_FAILED);
+    }
+    uint8_t *area = static_cast<uint8_t*>(p);
+    uint8_t *start = area + ((offset - (off_t)(uintptr_t)area) % align + align) % align;
+    if (mmap(start, size, PROT_READ, flags | MAP_FIXED, fd, offset) == MAP_FAILED) {
+        munmap(area, reserved);
+        return static_cast<uint8_t*>(MAP_FAILED);
+    }
+    uint8_t *end = start + round_up(size, system_page_size());
+    if (start > area) {
+        munmap(area, start - area);
+    }
+    if (end < area + reserved) {
+        munmap(end, area + reserved - end);
+    }
+    return start;
+}
+
+MetaChunkRef MetaChunkWindow::map(int fd, off_t offset, off_t size, const SourceOptions &opts) {
+    // Wait for the consumer to retire an older metachunk
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return live < capacity; });
+        live++;
+        if (live > max_live) max_live = live;
+    }
+
+    timespec map_start, map_end;
+    clock_gettime(CLOCK_MONOTONIC, &map_start);
+    uint64_t start = read_tsc();
+    int flags = MAP_PRIVATE;
+    if (opts.prefault && !opts.consumer_faults) flags |= MAP_POPULATE;
+    MetaChunk *m = new MetaChunk();
+    m->start = map_file(fd, offset, size, flags, opts.huge_pages);
+    if (m->start == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+    m->size = size;
+    m->offset = offset;
+    madvise(m->start, m->size, opts.advice);
+    // Fails where the kernel has no transparent huge pages at all
+    if (opts.huge_pages) {
+        if (madvise(m->start, m->size, MADV_HUGEPAGE) == 0) {
+            advised++;
+        } else {
+            advice_failed++;
+        }
+    }
+    if (opts.latency) opts.latency->record(opts.latency_stage, read_tsc() - start);
+    clock_gettime(CLOCK_MONOTONIC, &map_end);
+    iotrace(metachunk_map, m->offset, m->size, duration_ns(map_start, map_end));
+
+    ResidencyTracker *residency = opts.residency;
+    return MetaChunkRef(m, [this, residency](MetaChunk *m) { release(m, residency); });
+}
+
+void MetaChunkWindow::release(MetaChunk *m, ResidencyTracker *residency) {
+    if (residency && m->region != -1) {
+        residency->complete(m->region, m->start, m->size);
+    }
+
+    timespec unmap_start, unmap_end;
+    clock_gettime(CLOCK_MONOTONIC, &unmap_start);
+    if (munmap(m->start, m->size) == -1) {
+        perror("munmap");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &unmap_end);
+    iotrace(metachunk_unmap, m->offset, m->size, duration_ns(unmap_start, unmap_end));
+    delete m;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    live--;
+    cv.notify_one();
+}
+
+int MetaChunkWindow::peak() const {
+    return max_live;
+}
+
+int MetaChunkWindow::huge_advised() const {
+    return advised.load();
+}
+
+int MetaChunkWindow::huge_advice_failed() const {
+    return advice_failed.load();
+}
+
+// Maps the metachunks of a file in order. With a depth greater than 0, a
+// helper thread maps and warms up to depth metachunks ahead of the
+// consumer, from the first call to next() on so that nothing is read
+// before the consumer starts; with a depth of 0, mapping happens
+// synchronously in next().
+class Prefetcher {
+public:
+    Prefetcher(int fd, off_t filesize, MetaChunkWindow &window, const SourceOptions &opts);
+    ~Prefetcher();
+    // Returns NULL once the whole file has been handed out
+    MetaChunkRef next();
+    // Stops and joins the helper thread
+    void stop();
+
+private:
+    MetaChunkRef map_next();
+    void run();
+
+    int fd;
+    off_t filesize;
+    MetaChunkWindow &window;
+    const SourceOptions &opts;
+    off_t next_offset = 0;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<MetaChunkRef> ready;
+    bool done = false;
+    bool stopping = false;
+    std::thread thread;
+};
+
+Prefetcher::Prefetcher(int fd, off_t filesize, MetaChunkWindow &window, const SourceOptions &opts)
+    : fd(fd), filesize(filesize), window(window), opts(opts) {
+}
+
+Prefetcher::~Prefetcher() {
+    stop();
+}
+
+void Prefetcher::stop() {
+    // Unblock the helper thread if the consumer stopped early
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        ready.clear();
+        cv.notify_all();
+    }
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+MetaChunkRef Prefetcher::map_next() {
+    if (next_offset >= filesize) {
+        return NULL;
+    }
+    off_t remaining = filesize - next_offset;
+    off_t size = remaining > opts.meta_chunk_size ? opts.meta_chunk_size : remaining;
+    MetaChunkRef m = window.map(fd, next_offset, size, opts);
+    next_offset += size;
+    return m;
+}
+
+void Prefetcher::run() {
+    while (true) {
+        MetaChunkRef m = map_next();
+        if (m == NULL) {
+            break;
+        }
+        // MAP_POPULATE already faulted everything in, otherwise
+        // start the read-ahead without waiting for it
+        if (!opts.prefault && !opts.consumer_faults) {
+            madvise(m->start, m->size, MADV_WILLNEED);
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return (int)ready.size() < opts.prefetch || stopping; });
+        if (stopping) {
+            break;
+        }
+        ready.push_back(m);
+        cv.notify_all();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    done = true;
+    cv.notify_all();
+}
+
+MetaChunkRef Prefetcher::next() {
+    if (opts.prefetch == 0) {
+        return map_next();
+    }
+    if (!thread.joinable()) {
+        thread = std::thread(&Prefetcher::run, this);
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this] { return !ready.empty() || done; });
+    if (ready.empty()) {
+        return NULL;
+    }
+    MetaChunkRef m = ready.front();
+    ready.pop_front();
+    cv.notify_all();
+    return m;
+}
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22
+#endif
+
+// Faults in a chunk from the calling thread, like MAP_POPULATE does for
+// a whole mapping. Touches each page before Linux 5.14.
+static void prefault(uint8_t *start, off_t size) {
+    if (madvise(start, size, MADV_POPULATE_READ) == 0) {
+        return;
+    }
+    size_t page = system_page_size();
+    volatile uint8_t sink = 0;
+    for (off_t offset = 0; offset < size; offset += page) {
+        sink += start[offset];
+    }
+}
+
+void fault_in(uint8_t *start, off_t size, bool prefault_pages) {
+    if (prefault_pages) {
+        prefault(start, size);
+    } else {
+        madvise(start, size, MADV_WILLNEED);
+    }
+}
+
+// Maps the file one metachunk at a time and splits each into chunks
+class MmapSource : public ChunkSource {
+public:
+    MmapSource(int fd, off_t filesize, const SourceOptions &opts);
+    ~MmapSource();
+    void print_stats() const;
+    void report_stats(Report &r) const;
+    void finish();
+
+protected:
+    bool read_next(Chunk &c);
+
+private:
+    int fd;
+    SourceOptions opts;
+    MetaChunkWindow window;
+    Prefetcher prefetcher;
+    // Metachunk currently being split into chunks
+    MetaChunkRef metachunk;
+};
+
+MmapSource::MmapSource(int fd, off_t filesize, const SourceOptions &opts)
+    : ChunkSource(filesize), fd(fd), opts(opts), window(opts.window),
+      prefetcher(fd, filesize, window, this->opts) {
+}
+
+MmapSource::~MmapSource() {
+    // The helper thread maps from fd until it is joined
+    metachunk.reset();
+    prefetcher.stop();
+    close(fd);
+}
+
+void MmapSource::finish() {
+    metachunk.reset();
+    prefetcher.stop();
+}
+
+bool MmapSource::read_next(Chunk &c) {
+    // Check if we need to mmap a new metachunk
+    // Happens if no metachunk is mmap'd and
+    // when we have processed all the chunks
+    if (metachunk == NULL || metachunk->processed >= metachunk->size) {
+        // Drop our reference to the old one, it gets unmapped
+        // once its last chunk is released
+        metachunk.reset();
+        metachunk = prefetcher.next();
+
+        // Ending condition : we have read the last chunk of 
+        // the last metachunk
+        if (metachunk == NULL) {
+            return false;
+        }
+        if (opts.residency) {
+            metachunk->region = opts.residency->dispatch(metachunk->start, metachunk->offset, metachunk->size);
+        }
+    }
+
+    // Dispatch the next chunk
+    off_t remaining = metachunk->size - metachunk->processed;
+    c.start = metachunk->start + metachunk->processed;
+    c.offset = metachunk->offset + metachunk->processed;
+    c.size = remaining > opts.chunk_size ? opts.chunk_size : remaining;
+    c.owner = metachunk;
+    metachunk->processed += c.size;
+
+    if (opts.consumer_faults) {
+        fault_in(c.start, c.size, opts.prefault);
+    }
+
+    return true;
+}
+
+void MmapSource::print_stats() const {
+    printf("Prefetch depth: %d\n", opts.prefetch);
+    printf("Peak mapped metachunks: %d\n", window.peak());
+    if (opts.huge_pages) {
+        printf("Huge page advice: %d metachunks advised, %d failed (not a count of huge pages used)\n",
+                window.huge_advised(), window.huge_advice_failed());
+    }
+}
+
+void MmapSource::report_stats(Report &r) const {
+    Report::Section &s = r.section("source");
+    s.set("prefetch_depth", opts.prefetch);
+    s.set("peak_metachunks", window.peak());
+    s.set("huge_pages", opts.huge_pages);
+    if (opts.huge_pages) {
+        s.set("huge_advised", window.huge_advised());
+        s.set("huge_advice_failed", window.huge_advice_failed());
+    }
+}
+
+ChunkSource *make_mmap_source(int fd, off_t filesize, const SourceOptions &opts) {
+    return new MmapSource(fd, filesize, opts);
+}
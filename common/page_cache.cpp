@@ -0,0 +1,132 @@
+#include "page_cache.h"
+#include "report.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifndef __NR_cachestat
+#define __NR_cachestat 451
+#endif
+
+// From linux/mman.h, missing from older headers
+struct cachestat_range {
+    uint64_t off;
+    uint64_t len;
+};
+
+struct cachestat {
+    uint64_t nr_cache;
+    uint64_t nr_dirty;
+    uint64_t nr_writeback;
+    uint64_t nr_evicted;
+    uint64_t nr_recently_evicted;
+};
+
+// Size of the mappings mincore() goes through, to bound the vector
+static const off_t MINCORE_WINDOW = 1L << 30;
+
+static double mincore_residency(int fd, off_t filesize) {
+    size_t page = system_page_size();
+    uint64_t resident = 0;
+    std::vector<unsigned char> vec(MINCORE_WINDOW / page);
+    for (off_t offset = 0; offset < filesize; offset += MINCORE_WINDOW) {
+        size_t length = std::min(MINCORE_WINDOW, filesize - offset);
+        void *addr = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, offset);
+        if (addr == MAP_FAILED) {
+            return -1;
+        }
+        int ret = mincore(addr, length, vec.data());
+        munmap(addr, length);
+        if (ret == -1) {
+            return -1;
+        }
+        size_t pages = (length + page - 1) / page;
+        for (size_t i = 0; i < pages; i++) {
+            resident += vec[i] & 1;
+        }
+    }
+    return (double)resident / (double)((filesize + page - 1) / page);
+}
+
+double cache_residency(int fd) {
+    off_t filesize = get_filesize(fd);
+    if (filesize <= 0) {
+        return filesize == 0 ? 0 : -1;
+    }
+
+    struct cachestat_range range = { 0, (uint64_t)filesize };
+    struct cachestat cs;
+    if (syscall(__NR_cachestat, fd, &range, &cs, 0) == 0) {
+        size_t page = system_page_size();
+        return (double)cs.nr_cache / (double)((filesize + page - 1) / page);
+    }
+    return mincore_residency(fd, filesize);
+}
+
+Eviction evict_file(const std::string &filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Error: cannot open file %s: %s\n", filename.c_str(), strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    Eviction ret;
+    ret.bytes = get_filesize(fd);
+    double residency = cache_residency(fd);
+    ret.before = residency < 0 ? -1 : 100.0 * residency;
+    if (fdatasync(fd) == -1) {
+        perror("fdatasync");
+    }
+    int err = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    if (err != 0) {
+        fprintf(stderr, "posix_fadvise: %s\n", strerror(err));
+    }
+    residency = cache_residency(fd);
+    ret.after = residency < 0 ? -1 : 100.0 * residency;
+    close(fd);
+    return ret;
+}
+
+Eviction evict_files(const std::vector<std::string> &files) {
+    Eviction ret;
+    double before = 0, after = 0;
+    for (const std::string &file : files) {
+        Eviction e = evict_file(file);
+        if (e.before < 0 || before < 0) {
+            before = -1;
+        } else {
+            before += e.before * e.bytes;
+        }
+        if (e.after < 0 || after < 0) {
+            after = -1;
+        } else {
+            after += e.after * e.bytes;
+        }
+        ret.bytes += e.bytes;
+    }
+    ret.before = before < 0 || ret.bytes == 0 ? before : before / ret.bytes;
+    ret.after = after < 0 || ret.bytes == 0 ? after : after / ret.bytes;
+    return ret;
+}
+
+void print_eviction(const Eviction &eviction) {
+    printf("Cache residency before eviction (%%): %.1f\n", eviction.before);
+    printf("Cache residency after eviction (%%): %.1f\n", eviction.after);
+}
+
+void report_eviction(Report &r, const Eviction &eviction) {
+    Report::Section &s = r.section("cache");
+    s.set("residency_before_pct", eviction.before);
+    s.set("residency_after_pct", eviction.after);
+}
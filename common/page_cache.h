@@ -0,0 +1,38 @@
+#ifndef COMMON_PAGE_CACHE_H
+#define COMMON_PAGE_CACHE_H
+
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+class Report;
+
+// Fraction of the pages of the file that are in the page cache, between
+// 0 and 1, or -1 on error. Uses cachestat() when the kernel has it and
+// mincore() on a mapping of the file otherwise.
+double cache_residency(int fd);
+
+// Residency of the input file around an eviction, in percent, or -1 if
+// it could not be measured
+struct Eviction {
+    double before = 0;
+    double after = 0;
+    // Size of the evicted files
+    off_t bytes = 0;
+};
+
+// Drops the cached pages of one file, without root and without touching
+// the rest of the page cache: dirty pages are written back with
+// fdatasync() and the clean ones dropped with POSIX_FADV_DONTNEED. Pages
+// mapped by other processes stay cached. Exits if the file cannot be
+// opened.
+Eviction evict_file(const std::string &filename);
+// Same for each of files, residency being over all their bytes
+Eviction evict_files(const std::vector<std::string> &files);
+
+void print_eviction(const Eviction &eviction);
+// Same, in the "cache" section of a report
+void report_eviction(Report &r, const Eviction &eviction);
+
+#endif // COMMON_PAGE_CACHE_H
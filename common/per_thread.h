@@ -0,0 +1,100 @@
+#ifndef COMMON_PER_THREAD_H
+#define COMMON_PER_THREAD_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+struct PerThreadSlot {
+    uint64_t id;
+    void *value;
+};
+
+// Slots of a thread, one per live PerThread instance it has used. The
+// instances keep a reference to it and take their slot back when they
+// go away, so the mutex is only ever contended at that point.
+struct PerThreadSlots {
+    std::mutex mutex;
+    std::vector<PerThreadSlot> slots;
+};
+
+inline const std::shared_ptr<PerThreadSlots> &per_thread_slots() {
+    static thread_local std::shared_ptr<PerThreadSlots> slots(new PerThreadSlots());
+    return slots;
+}
+
+inline uint64_t per_thread_next_id() {
+    static std::atomic<uint64_t> next(0);
+    return next++;
+}
+
+// Gives each thread its own T, created on first use and kept until the
+// PerThread goes away, which also clears the slots it used in every
+// thread. Once the thread has its T, local() only takes an uncontended
+// lock of the calling thread; all() is meant for merging results after
+// the workers are done.
+template <typename T>
+class PerThread {
+public:
+    PerThread() : id(per_thread_next_id()) {
+    }
+
+    ~PerThread() {
+        for (const std::shared_ptr<PerThreadSlots> &thread : threads) {
+            std::lock_guard<std::mutex> lock(thread->mutex);
+            std::vector<PerThreadSlot> &slots = thread->slots;
+            slots.erase(std::remove_if(slots.begin(), slots.end(),
+                    [this](const PerThreadSlot &slot) { return slot.id == id; }), slots.end());
+        }
+        for (T *value : values) {
+            delete value;
+        }
+    }
+
+    // Arguments are passed to the constructor of T the first time
+    // the calling thread asks for it
+    template <typename... Args>
+    T &local(Args&&... args) {
+        const std::shared_ptr<PerThreadSlots> &mine = per_thread_slots();
+        {
+            std::lock_guard<std::mutex> lock(mine->mutex);
+            for (const PerThreadSlot &slot : mine->slots) {
+                if (slot.id == id) {
+                    return *static_cast<T *>(slot.value);
+                }
+            }
+        }
+
+        T *value = new T(std::forward<Args>(args)...);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            values.push_back(value);
+            threads.push_back(mine);
+        }
+        std::lock_guard<std::mutex> lock(mine->mutex);
+        mine->slots.push_back(PerThreadSlot { id, value });
+        return *value;
+    }
+
+    // In the order threads first called local()
+    std::vector<T *> all() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return values;
+    }
+
+private:
+    PerThread(const PerThread &);
+    PerThread &operator=(const PerThread &);
+
+    uint64_t id;
+    mutable std::mutex mutex;
+    std::vector<T *> values;
+    // Slots of the threads that have a T
+    std::vector<std::shared_ptr<PerThreadSlots> > threads;
+};
+
+#endif // COMMON_PER_THREAD_H
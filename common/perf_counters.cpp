@@ -0,0 +1,237 @@
+#include "perf_counters.h"
+#include "report.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static const char *const counter_names[] = {
+    "instructions",
+    "cycles",
+    "llc-misses",
+    "dtlb-misses",
+    "minor-faults",
+    "major-faults",
+};
+
+const char *counter_name(CounterEvent event) {
+    return counter_names[event];
+}
+
+CounterValues &CounterValues::operator+=(const CounterValues &other) {
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        values[i] += other.values[i];
+    }
+    return *this;
+}
+
+static void event_attr(CounterEvent event, struct perf_event_attr &attr) {
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    switch (event) {
+        case COUNTER_INSTRUCTIONS:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case COUNTER_CYCLES:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case COUNTER_LLC_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        case COUNTER_DTLB_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        case COUNTER_MINOR_FAULTS:
+            attr.type = PERF_TYPE_SOFTWARE;
+            attr.config = PERF_COUNT_SW_PAGE_FAULTS_MIN;
+            break;
+        case COUNTER_MAJOR_FAULTS:
+            attr.type = PERF_TYPE_SOFTWARE;
+            attr.config = PERF_COUNT_SW_PAGE_FAULTS_MAJ;
+            break;
+        default:
+            break;
+    }
+}
+
+PerfCounters::ThreadCounters::ThreadCounters(size_t nstages)
+    : tid(syscall(SYS_gettid)), stages(nstages) {
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        struct perf_event_attr attr;
+        event_attr(static_cast<CounterEvent>(i), attr);
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.disabled = leader == -1;
+        fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+        slot[i] = -1;
+        if (fds[i] == -1) {
+            continue;
+        }
+        if (leader == -1) {
+            leader = fds[i];
+        }
+        slot[i] = nopened++;
+    }
+    if (leader != -1) {
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+PerfCounters::ThreadCounters::~ThreadCounters() {
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        if (fds[i] != -1) {
+            close(fds[i]);
+        }
+    }
+}
+
+PerfCounters::PerfCounters(const std::vector<std::string> &stages) : stages(stages) {
+}
+
+PerfCounters::~PerfCounters() {
+}
+
+CounterValues PerfCounters::read() {
+    ThreadCounters &t = threads.local(stages.size());
+    CounterValues ret;
+    if (t.leader == -1) {
+        return ret;
+    }
+
+    // Number of events, time enabled, time running, then the values
+    uint64_t buf[3 + NUM_COUNTERS];
+    if (::read(t.leader, buf, sizeof(buf)) == -1) {
+        return ret;
+    }
+    ret.time_enabled = buf[1];
+    ret.time_running = buf[2];
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        if (t.slot[i] != -1) {
+            ret.values[i] = buf[3 + t.slot[i]];
+        }
+    }
+    return ret;
+}
+
+CounterValues PerfCounters::add(int stage, const CounterValues &begin) {
+    CounterValues end = read();
+    ThreadCounters &t = threads.local(stages.size());
+    CounterValues delta;
+
+    // The group is scheduled as a whole, so when the PMU is shared
+    // with other groups all its events ran for the same fraction of
+    // the interval and are scaled up by the same ratio. Scaling the
+    // cumulative counts of each read instead would mix two ratios.
+    uint64_t enabled = end.time_enabled - begin.time_enabled;
+    uint64_t running = end.time_running - begin.time_running;
+    double scale = 1.0;
+    if (running < enabled) {
+        t.multiplexed = true;
+        scale = running > 0 ? (double)enabled / running : 0.0;
+    }
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        delta.values[i] = (end.values[i] - begin.values[i]) * scale;
+        t.stages[stage].values[i] += delta.values[i];
+    }
+    delta.time_enabled = enabled;
+    delta.time_running = running;
+    return delta;
+}
+
+bool PerfCounters::is_available(CounterEvent event) const {
+    for (const ThreadCounters *t : threads.all()) {
+        if (t->fds[event] == -1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool PerfCounters::is_multiplexed() const {
+    for (const ThreadCounters *t : threads.all()) {
+        if (t->multiplexed) {
+            return true;
+        }
+    }
+    return false;
+}
+
+CounterValues PerfCounters::stage_total(int stage) const {
+    CounterValues total;
+    for (const ThreadCounters *t : threads.all()) {
+        total += t->stages[stage];
+    }
+    return total;
+}
+
+static void print_values(const CounterValues &v, const bool *available) {
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        if (available[i]) {
+            printf(" %s:%lu", counter_names[i], v.values[i]);
+        } else {
+            printf(" %s:n/a", counter_names[i]);
+        }
+    }
+    printf("\n");
+}
+
+void PerfCounters::print() const {
+    bool available[NUM_COUNTERS];
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        available[i] = is_available(static_cast<CounterEvent>(i));
+    }
+
+    std::vector<ThreadCounters *> all = threads.all();
+    for (size_t i = 0; i < all.size(); i++) {
+        for (size_t s = 0; s < stages.size(); s++) {
+            printf("Thread %zu (tid %d) %s:", i, all[i]->tid, stages[s].c_str());
+            print_values(all[i]->stages[s], available);
+        }
+    }
+    for (size_t s = 0; s < stages.size(); s++) {
+        printf("Stage %s:", stages[s].c_str());
+        print_values(stage_total(s), available);
+    }
+    if (is_multiplexed()) {
+        printf("Counters were multiplexed, counts are scaled estimates\n");
+    }
+}
+
+void PerfCounters::report(Report &r) const {
+    bool available[NUM_COUNTERS];
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        available[i] = is_available(static_cast<CounterEvent>(i));
+    }
+
+    for (const ThreadCounters *t : threads.all()) {
+        Report::Section &thread = r.worker(t->tid);
+        for (size_t s = 0; s < stages.size(); s++) {
+            for (int i = 0; i < NUM_COUNTERS; i++) {
+                if (available[i]) {
+                    thread.set(stages[s] + "." + counter_names[i], (unsigned long)t->stages[s].values[i]);
+                }
+            }
+        }
+    }
+    Report::Section &totals = r.section("counters");
+    totals.set("multiplexed", is_multiplexed());
+    for (size_t s = 0; s < stages.size(); s++) {
+        CounterValues total = stage_total(s);
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            if (available[i]) {
+                totals.set(stages[s] + "." + counter_names[i], (unsigned long)total.values[i]);
+            }
+        }
+    }
+}
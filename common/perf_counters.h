@@ -0,0 +1,92 @@
+#ifndef COMMON_PERF_COUNTERS_H
+#define COMMON_PERF_COUNTERS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "per_thread.h"
+
+class Report;
+
+enum CounterEvent {
+    COUNTER_INSTRUCTIONS,
+    COUNTER_CYCLES,
+    COUNTER_LLC_MISSES,
+    COUNTER_DTLB_MISSES,
+    COUNTER_MINOR_FAULTS,
+    COUNTER_MAJOR_FAULTS,
+    NUM_COUNTERS,
+};
+
+const char *counter_name(CounterEvent event);
+
+struct CounterValues {
+    uint64_t values[NUM_COUNTERS] = {};
+    // Of the group, in nanoseconds, only set by PerfCounters::read()
+    uint64_t time_enabled = 0;
+    uint64_t time_running = 0;
+
+    CounterValues &operator+=(const CounterValues &other);
+};
+
+// Per-thread hardware and software counters read with perf_event_open,
+// accumulated per stage. A worker brackets the work of a stage with
+// read() and add():
+//
+//     CounterValues begin = counters.read();
+//     ...
+//     counters.add(stage, begin);
+//
+// Counters are opened for a thread the first time it calls read().
+// Events the kernel or the machine does not support read as zero and
+// are reported as unavailable. read() returns raw counts; when the PMU
+// has to multiplex the events with other users, add() scales the counts
+// of the interval by its time enabled over its time running and flags
+// them as estimates.
+class PerfCounters {
+public:
+    PerfCounters(const std::vector<std::string> &stages);
+    ~PerfCounters();
+
+    CounterValues read();
+    // Adds the counts since begin to stage, and returns them
+    CounterValues add(int stage, const CounterValues &begin);
+
+    // False if the event could not be opened on some thread
+    bool is_available(CounterEvent event) const;
+    // True if counts on some thread had to be scaled
+    bool is_multiplexed() const;
+    // Totals for a stage, over all threads
+    CounterValues stage_total(int stage) const;
+    // Prints counters per thread and per stage, then stage totals
+    void print() const;
+    // Same values, per thread (see Report::worker()) and in the
+    // "counters" section.
+    // Unavailable events are left out.
+    void report(Report &r) const;
+
+private:
+    struct ThreadCounters {
+        ThreadCounters(size_t nstages);
+        ~ThreadCounters();
+
+        pid_t tid;
+        // All events that could be opened are in one group,
+        // read at once through the leader
+        int leader = -1;
+        int fds[NUM_COUNTERS];
+        // Position of each event in a group read, -1 if not opened
+        int slot[NUM_COUNTERS];
+        int nopened = 0;
+        bool multiplexed = false;
+        std::vector<CounterValues> stages;
+    };
+
+    std::vector<std::string> stages;
+    PerThread<ThreadCounters> threads;
+};
+
+#endif // COMMON_PERF_COUNTERS_H
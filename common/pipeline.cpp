@@ -0,0 +1,439 @@
+#include "pipeline.h"
+#include "affinity.h"
+#include "histogram.h"
+#include "iotrace.h"
+#include "perf_counters.h"
+#include "report.h"
+#include "util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <tbb/tbb.h>
+
+const std::vector<std::string> pipeline_stages = { "input", "process", "output" };
+const std::vector<std::string> pipeline_latency_stages = { "input", "map", "process", "queue", "page" };
+
+static const char *const file_schedule_names[] = {
+    "interleaved",
+    "parallel",
+};
+
+bool parse_file_schedule(const char *name, FileSchedule &schedule) {
+    for (int i = 0; i <= FILES_PARALLEL; i++) {
+        if (strcmp(name, file_schedule_names[i]) == 0) {
+            schedule = static_cast<FileSchedule>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *file_schedule_name(FileSchedule schedule) {
+    return file_schedule_names[schedule];
+}
+
+WorkerStats::WorkerStats() : tid(syscall(SYS_gettid)) {
+}
+
+// Token passed along the pipeline
+struct Item {
+    Chunk chunk;
+    uint64_t result = 0;
+    // Time spent in the kernel, in nanoseconds
+    uint64_t kernel_time = 0;
+    uint64_t accesses = 0;
+    // Bytes the kernel went through
+    uint64_t visited = 0;
+    // TSC when the process filter was done with it
+    uint64_t processed_at = 0;
+};
+
+// Nanoseconds since start
+static uint64_t since(const timespec &start) {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return duration_ns(start, now);
+}
+
+class InputFunctor {
+public:
+    InputFunctor(ChunkSource &source, const PipelineProbes &probes);
+    Item operator()(tbb::flow_control &fc) const;
+
+private:
+    ChunkSource &source;
+    PipelineProbes probes;
+};
+
+InputFunctor::InputFunctor(ChunkSource &source, const PipelineProbes &probes)
+    : source(source), probes(probes) {
+}
+
+Item InputFunctor::operator()(tbb::flow_control &fc) const {
+    CounterValues begin;
+    if (probes.counters) begin = probes.counters->read();
+    uint64_t start = read_tsc();
+
+    Item item;
+    if (!source.next(item.chunk)) {
+        fc.stop();
+    }
+
+    if (probes.latency) probes.latency->record(LATENCY_INPUT, read_tsc() - start);
+    if (probes.counters) probes.counters->add(STAGE_INPUT, begin);
+    return item;
+}
+
+class ProcessFunctor {
+public:
+    ProcessFunctor(const PipelineConfig &config, KernelFunc kernel, const std::vector<PageOrders> &orders,
+            const PipelineProbes &probes);
+    Item operator()(Item input) const;
+
+private:
+    const PipelineConfig &config;
+    KernelFunc kernel;
+    // Per file, drawn before the run
+    const std::vector<PageOrders> &orders;
+    PipelineProbes probes;
+};
+
+ProcessFunctor::ProcessFunctor(const PipelineConfig &config, KernelFunc kernel, const std::vector<PageOrders> &orders,
+        const PipelineProbes &probes)
+    : config(config), kernel(kernel), orders(orders), probes(probes) {
+}
+
+Item ProcessFunctor::operator()(Item input) const {
+    CounterValues begin;
+    if (probes.counters) begin = probes.counters->read();
+
+    uint64_t npages = (input.chunk.size + PAGE_SIZE - 1) / PAGE_SIZE;
+    PageOrder order;
+    if (config.pattern.pattern != PATTERN_SEQUENTIAL) {
+        order = orders[input.chunk.file].of(input.chunk.offset);
+    }
+
+    iotrace(process_begin, input.chunk.id, iotrace_tid());
+    timespec start, end;
+    uint64_t tsc_start = read_tsc();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (!order) {
+        input.result = kernel(input.chunk.start, input.chunk.size, config.iterations);
+        input.accesses = npages;
+        input.visited = input.chunk.size;
+    } else {
+        for (uint32_t page : *order) {
+            off_t offset = (off_t)page * PAGE_SIZE;
+            off_t remaining = input.chunk.size - offset;
+            off_t size = remaining > PAGE_SIZE ? PAGE_SIZE : remaining;
+            uint64_t page_start = read_tsc();
+            input.result += kernel(input.chunk.start + offset, size, config.iterations);
+            if (probes.latency) probes.latency->record(LATENCY_PAGE, read_tsc() - page_start);
+            input.visited += size;
+        }
+        input.accesses = order->size();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    input.kernel_time = duration_ns(start, end);
+    input.processed_at = read_tsc();
+    iotrace(process_end, input.chunk.id, iotrace_tid());
+    if (probes.latency) probes.latency->record(LATENCY_PROCESS, input.processed_at - tsc_start);
+
+    if (probes.traffic) probes.traffic->add(input.chunk.start, input.chunk.size);
+
+    if (probes.workers) {
+        WorkerStats &worker = probes.workers->local();
+        worker.chunks++;
+        worker.bytes += input.visited;
+        worker.kernel_time += input.kernel_time;
+    }
+
+    if (probes.counters) probes.counters->add(STAGE_PROCESS, begin);
+    return input;
+}
+
+// Serial, so it can add to the result without synchronization
+class OutputFunctor {
+public:
+    OutputFunctor(PipelineResult &result, const timespec &start, const PipelineProbes &probes);
+    void operator()(Item input) const;
+
+private:
+    PipelineResult &result;
+    const timespec &start;
+    PipelineProbes probes;
+};
+
+OutputFunctor::OutputFunctor(PipelineResult &result, const timespec &start, const PipelineProbes &probes)
+    : result(result), start(start), probes(probes) {
+}
+
+void OutputFunctor::operator()(Item input) const {
+    if (probes.latency) probes.latency->record(LATENCY_QUEUE, read_tsc() - input.processed_at);
+    CounterValues begin;
+    if (probes.counters) begin = probes.counters->read();
+
+    result.sum += input.result;
+    result.kernel_time += input.kernel_time;
+    result.accesses += input.accesses;
+    result.visited += input.visited;
+    FileResult &file = result.files[input.chunk.file];
+    file.bytes += input.chunk.size;
+    file.chunks++;
+    file.done_ns = since(start);
+    // Last chunk of a metachunk to retire unmaps it,
+    // read buffers go back to their pool
+    input.chunk.owner.reset();
+    iotrace(output_retire, input.chunk.id);
+
+    if (probes.counters) probes.counters->add(STAGE_OUTPUT, begin);
+}
+
+// Pins each thread the first time it enters the scheduler, in order
+class PinningObserver : public tbb::task_scheduler_observer {
+public:
+    PinningObserver(const CpuPlacement &placement);
+    ~PinningObserver();
+    void on_scheduler_entry(bool is_worker);
+
+private:
+    const CpuPlacement &placement;
+    std::atomic<int> next;
+    // Index of each thread, -1 until pinned
+    PerThread<int> pinned;
+};
+
+PinningObserver::PinningObserver(const CpuPlacement &placement) : placement(placement), next(0) {
+    observe(true);
+}
+
+PinningObserver::~PinningObserver() {
+    observe(false);
+}
+
+void PinningObserver::on_scheduler_entry(bool) {
+    int &index = pinned.local(-1);
+    if (index == -1) {
+        index = next++;
+        placement.pin(index);
+    }
+}
+
+WorkerPinning::WorkerPinning(Affinity affinity, bool membind)
+    : placement(affinity, membind), observer(new PinningObserver(placement)) {
+}
+
+WorkerPinning::~WorkerPinning() {
+    // The creating thread gets its CPUs back
+    observer.reset();
+    placement.unpin();
+}
+
+void WorkerPinning::enter() {
+    observer->on_scheduler_entry(false);
+}
+
+PipelinedReader::PipelinedReader(const PipelineConfig &config, const PipelineProbes &probes)
+    : config(config), probes(probes) {
+}
+
+PipelinedReader::~PipelinedReader() {
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+SourceOptions PipelinedReader::source_options() const {
+    SourceOptions opts;
+    opts.backend = config.backend;
+    opts.chunk_size = config.chunk_size;
+    opts.meta_chunk_size = config.meta_chunk_size;
+    opts.window = config.window;
+    opts.prefetch = config.prefetch;
+    opts.prefault = config.prefault;
+    opts.huge_pages = config.huge_pages;
+    opts.consumer_faults = config.membind;
+    opts.advice = MADV_SEQUENTIAL;
+    opts.queue_depth = config.queue_depth;
+    opts.held = config.ntokens;
+    if (probes.latency) {
+        opts.latency = probes.latency;
+        opts.latency_stage = LATENCY_MAP;
+    }
+    opts.residency = probes.residency;
+    return opts;
+}
+
+bool PipelinedReader::is_parallel() const {
+    return config.file_schedule == FILES_PARALLEL && config.files.size() > 1;
+}
+
+size_t PipelinedReader::lanes() const {
+    return std::min(config.files.size(), (size_t)std::max(config.open_files, 1));
+}
+
+void PipelinedReader::open() {
+    if (source || !readers.empty()) {
+        return;
+    }
+    if (is_parallel()) {
+        // A reader per file, placed by run(). Only those of the first
+        // lanes are opened, the others open when their turn comes.
+        for (const std::string &filename : config.files) {
+            PipelineConfig file_config = config;
+            file_config.files = { filename };
+            file_config.affinity = AFFINITY_NONE;
+            readers.emplace_back(new PipelinedReader(file_config, probes));
+            if (readers.size() <= lanes()) {
+                readers.back()->open();
+            }
+        }
+        return;
+    }
+
+    SourceOptions opts = source_options();
+    std::vector<std::unique_ptr<ChunkSource> > sources;
+    orders.clear();
+    for (const std::string &filename : config.files) {
+        sources.emplace_back(make_chunk_source(filename, opts));
+        // The mmap backend cuts chunks from each metachunk
+        orders.emplace_back(config.pattern, sources.back()->filesize(), config.chunk_size,
+                config.backend == BACKEND_MMAP ? config.meta_chunk_size : 0);
+    }
+    if (sources.size() == 1) {
+        source = std::move(sources[0]);
+    } else {
+        source.reset(new MultiSource(std::move(sources)));
+    }
+}
+
+PipelineResult PipelinedReader::run() {
+    PipelineResult result;
+    KernelFunc kernel = select_kernel(config.kernel, config.isa, result.isa);
+    for (const std::string &filename : config.files) {
+        FileResult file;
+        file.filename = filename;
+        result.files.push_back(file);
+    }
+
+    // Once for all the pipelines of the run, so that workers are
+    // numbered once whatever pipeline they join first
+    std::unique_ptr<WorkerPinning> pinning;
+    if (config.affinity != AFFINITY_NONE) {
+        pinning.reset(new WorkerPinning(config.affinity, config.membind));
+    }
+
+    // Backends are set up (buffers allocated and registered, rings
+    // created) before the clock starts, only reading is timed
+    open();
+    bool parallel = is_parallel();
+
+    timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (parallel) {
+        // Each lane reads files until there is none left, so that only
+        // lanes sources hold buffers at once
+        std::vector<std::unique_ptr<PipelinedReader> > readers = std::move(this->readers);
+        this->readers.clear();
+        std::vector<PipelineResult> parts(readers.size());
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> threads;
+        for (size_t l = 0; l < lanes(); l++) {
+            threads.emplace_back([&] {
+                for (size_t i = next++; i < readers.size(); i = next++) {
+                    parts[i] = readers[i]->run();
+                    parts[i].source->finish();
+                }
+            });
+        }
+        for (std::thread &t : threads) {
+            t.join();
+        }
+
+        std::vector<std::unique_ptr<ChunkSource> > sources;
+        for (size_t i = 0; i < parts.size(); i++) {
+            result.sum += parts[i].sum;
+            result.kernel_time += parts[i].kernel_time;
+            result.accesses += parts[i].accesses;
+            result.visited += parts[i].visited;
+            result.files[i] = parts[i].files[0];
+            sources.push_back(std::move(parts[i].source));
+        }
+        result.source.reset(new MultiSource(std::move(sources)));
+    } else {
+        result.source = std::move(source);
+
+        tbb::task_scheduler_init init(config.threads);
+        if (pinning) pinning->enter();
+
+        tbb::filter_t<void, Item> in(tbb::filter::serial_in_order, InputFunctor(*result.source, probes));
+        tbb::filter_t<Item, Item> process(tbb::filter::parallel, ProcessFunctor(config, kernel, orders, probes));
+        tbb::filter_t<Item, void> out(tbb::filter::serial_out_of_order, OutputFunctor(result, start, probes));
+        tbb::filter_t<void,void> merge = in & process & out;
+
+        tbb::parallel_pipeline(config.ntokens, merge);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    result.elapsed = time_diff(start, end);
+
+    return result;
+}
+
+void PipelinedReader::start() {
+    if (thread.joinable()) {
+        fprintf(stderr, "Error: reader started again before wait()\n");
+        exit(EXIT_FAILURE);
+    }
+    thread = std::thread([this] { result = run(); });
+}
+
+PipelineResult PipelinedReader::wait() {
+    thread.join();
+    return std::move(result);
+}
+
+std::vector<PipelineResult> run_concurrently(std::vector<std::unique_ptr<PipelinedReader> > &readers) {
+    for (std::unique_ptr<PipelinedReader> &reader : readers) {
+        reader->start();
+    }
+    std::vector<PipelineResult> results;
+    for (std::unique_ptr<PipelinedReader> &reader : readers) {
+        results.push_back(reader->wait());
+    }
+    return results;
+}
+
+static double file_bandwidth(const FileResult &file) {
+    uint64_t ns = file.done_ns;
+    return ns > 0 ? ((double)file.bytes / ((double)ns / NSECS_IN_SEC)) / (double)BYTES_IN_MBYTE : 0;
+}
+
+void print_file_results(const PipelineResult &result) {
+    for (size_t i = 0; i < result.files.size(); i++) {
+        const FileResult &file = result.files[i];
+        printf("File %zu %s: %lu bytes in %.3f s, bandwidth (MB/s): %f\n", i, file.filename.c_str(),
+                file.bytes, (double)file.done_ns / NSECS_IN_SEC, file_bandwidth(file));
+    }
+}
+
+void report_file_results(Report &r, const PipelineResult &result) {
+    for (size_t i = 0; i < result.files.size(); i++) {
+        const FileResult &file = result.files[i];
+        Report::Section &s = r.row("file", i);
+        s.set("filename", file.filename);
+        s.set("bytes", (unsigned long)file.bytes);
+        s.set("chunks", (unsigned long)file.chunks);
+        s.set("done_ns", (unsigned long)file.done_ns);
+        s.set("bandwidth_mbps", file_bandwidth(file));
+    }
+}
@@ -0,0 +1,215 @@
+#ifndef COMMON_PIPELINE_H
+#define COMMON_PIPELINE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+#include <time.h>
+
+#include "access_pattern.h"
+#include "affinity.h"
+#include "chunk_source.h"
+#include "kernels.h"
+#include "per_thread.h"
+
+class NodeTraffic;
+class PinningObserver;
+class PerfCounters;
+class Report;
+class ResidencyTracker;
+class StageHistograms;
+
+// Stages of the TBB pipeline, for PerfCounters
+enum Stage {
+    STAGE_INPUT,
+    STAGE_PROCESS,
+    STAGE_OUTPUT,
+};
+
+extern const std::vector<std::string> pipeline_stages;
+
+// Latency histograms: time in the input filter, time to map or read the
+// data (part of input, or on the prefetch thread), kernel time, time
+// waiting for the output filter once processed, and with an access
+// pattern other than sequential, time to process each page
+enum LatencyStage {
+    LATENCY_INPUT,
+    LATENCY_MAP,
+    LATENCY_PROCESS,
+    LATENCY_QUEUE,
+    LATENCY_PAGE,
+};
+
+extern const std::vector<std::string> pipeline_latency_stages;
+
+// How a pipeline goes through many files
+enum FileSchedule {
+    // One pipeline, taking a chunk from each file in turn
+    FILES_INTERLEAVED,
+    // One pipeline per file, up to PipelineConfig::open_files running
+    // at once on the same TBB workers
+    FILES_PARALLEL,
+};
+
+// Returns false if name is not a known schedule
+bool parse_file_schedule(const char *name, FileSchedule &schedule);
+const char *file_schedule_name(FileSchedule schedule);
+
+// Everything a run of the pipeline depends on, with defaults already
+// applied: sizes are page multiples and window fits ntokens
+struct PipelineConfig {
+    // Regular files, see expand_inputs()
+    std::vector<std::string> files;
+    FileSchedule file_schedule = FILES_INTERLEAVED;
+    // With FILES_PARALLEL, files read at once, each through its own
+    // source and buffers, given back as soon as the file is done. The
+    // first ones are opened before the run, the others when their turn
+    // comes.
+    int open_files = 1;
+    int iterations = 0;
+    int threads = 0;
+    int ntokens = 0;
+    off_t meta_chunk_size = 0;
+    off_t chunk_size = 0;
+    int window = 0;
+    int prefetch = 0;
+    Backend backend = BACKEND_MMAP;
+    int queue_depth = 0;
+    bool prefault = false;
+    // See SourceOptions::huge_pages
+    bool huge_pages = false;
+    // Placement of the TBB threads, the thread calling
+    // PipelinedReader::run() being worker 0. With membind, each worker
+    // prefers memory from its node and chunks are faulted in by the
+    // worker that takes them, which TBB usually also has process them.
+    Affinity affinity = AFFINITY_NONE;
+    bool membind = false;
+    Kernel kernel = KERNEL_TOUCH;
+    // Capped to what the CPU supports
+    Isa isa = ISA_AVX512;
+    // Order of the pages within each chunk. Sequential runs the kernel
+    // once over the chunk, the others once per page.
+    PatternOptions pattern;
+};
+
+// Work done by each thread in the process filter
+struct WorkerStats {
+    WorkerStats();
+
+    pid_t tid;
+    uint64_t chunks = 0;
+    uint64_t bytes = 0;
+    uint64_t kernel_time = 0;
+};
+
+// Optional instrumentation of a run, left out when NULL
+struct PipelineProbes {
+    PerfCounters *counters = NULL;
+    StageHistograms *latency = NULL;
+    PerThread<WorkerStats> *workers = NULL;
+    // Only used by the mmap backend
+    ResidencyTracker *residency = NULL;
+    NodeTraffic *traffic = NULL;
+};
+
+// What a run got from each file. Files are timed from when reading them
+// starts, the start of the run unless FILES_PARALLEL has them wait for
+// their turn, until their last chunk retired.
+struct FileResult {
+    std::string filename;
+    uint64_t bytes = 0;
+    uint64_t chunks = 0;
+    // Nanoseconds since reading the file started
+    uint64_t done_ns = 0;
+};
+
+struct PipelineResult {
+    // Kept open for its statistics, a MultiSource with many files
+    std::unique_ptr<ChunkSource> source;
+    // In the order of PipelineConfig::files
+    std::vector<FileResult> files;
+    // From the first read until the last chunk retires
+    timespec elapsed;
+    uint64_t sum = 0;
+    // Time spent in the kernel, summed over all threads, in nanoseconds
+    uint64_t kernel_time = 0;
+    // Pages visited, more than once for some with PATTERN_ZIPFIAN
+    uint64_t accesses = 0;
+    // Bytes of the pages visited, what bandwidth is over
+    uint64_t visited = 0;
+    // Instruction set the kernel ended up using
+    Isa isa = ISA_SCALAR;
+};
+
+// Pins TBB threads as they join any pipeline, for as long as it lives,
+// numbering them across all pipelines. PipelinedReader sets one up for
+// config.affinity; readers running at once must instead share one, and
+// be configured with AFFINITY_NONE.
+class WorkerPinning {
+public:
+    WorkerPinning(Affinity affinity, bool membind);
+    ~WorkerPinning();
+
+    // Pins the calling thread, if not already done
+    void enter();
+
+private:
+    CpuPlacement placement;
+    std::unique_ptr<PinningObserver> observer;
+};
+
+// Reads config.files through an input, process and output pipeline on
+// config.threads threads, or one such pipeline per file with
+// FILES_PARALLEL. All the state of a run lives in the reader and its
+// result, so a reader can be run again, and many readers can run at
+// once from different threads: their pipelines then share the TBB
+// worker threads. Probes can be shared between readers that run at
+// once. Exits if a file cannot be opened.
+class PipelinedReader {
+public:
+    PipelinedReader(const PipelineConfig &config, const PipelineProbes &probes = PipelineProbes());
+    ~PipelinedReader();
+
+    // Opens the files, sets up the backend and draws the page orders for
+    // the next run, so that it is not timed. With FILES_PARALLEL, only
+    // the first open_files files are. Done by run() if not called before.
+    void open();
+    // Reads all the files once, on the calling thread
+    PipelineResult run();
+    // Same, on a thread of the reader, until wait() returns the result.
+    // Exits if the reader is already started.
+    void start();
+    PipelineResult wait();
+
+private:
+    SourceOptions source_options() const;
+    // One pipeline per file, and how many run at once
+    bool is_parallel() const;
+    size_t lanes() const;
+
+    const PipelineConfig config;
+    const PipelineProbes probes;
+    // Opened ahead of the run, then handed over to its result
+    std::unique_ptr<ChunkSource> source;
+    // Page order of each file, with an access pattern
+    std::vector<PageOrders> orders;
+    // With FILES_PARALLEL, the reader of each file instead, set up
+    // ahead of the run like source
+    std::vector<std::unique_ptr<PipelinedReader> > readers;
+    std::thread thread;
+    PipelineResult result;
+};
+
+// Runs readers at the same time and returns their results, in order
+std::vector<PipelineResult> run_concurrently(std::vector<std::unique_ptr<PipelinedReader> > &readers);
+
+// Bytes and bandwidth of each file of a run
+void print_file_results(const PipelineResult &result);
+// Same, as a "file" table
+void report_file_results(Report &r, const PipelineResult &result);
+
+#endif // COMMON_PIPELINE_H
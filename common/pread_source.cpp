@@ -0,0 +1,101 @@
+#include "sources.h"
+#include "buffer_pool.h"
+#include "histogram.h"
+#include "report.h"
+#include "util.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <unistd.h>
+
+// Copies the file into a pool of page-aligned buffers with pread. Used
+// for both buffered and O_DIRECT reads, depending on how fd was opened.
+class PreadSource : public ChunkSource {
+public:
+    PreadSource(int fd, off_t filesize, const SourceOptions &opts);
+    ~PreadSource();
+    void print_stats() const;
+    void report_stats(Report &r) const;
+    void finish();
+
+protected:
+    bool read_next(Chunk &c);
+
+private:
+    int fd;
+    SourceOptions opts;
+    BufferPool pool;
+    off_t next_offset = 0;
+};
+
+PreadSource::PreadSource(int fd, off_t filesize, const SourceOptions &opts)
+    : ChunkSource(filesize), fd(fd), opts(opts), pool(opts.held, opts.chunk_size, opts.huge_pages) {
+}
+
+PreadSource::~PreadSource() {
+    close(fd);
+}
+
+bool PreadSource::read_next(Chunk &c) {
+    if (next_offset >= size) {
+        return false;
+    }
+
+    int buffer = pool.acquire(true);
+    uint8_t *buf = pool.data(buffer);
+    off_t remaining = size - next_offset;
+    off_t to_read = remaining > opts.chunk_size ? opts.chunk_size : remaining;
+
+    // With O_DIRECT, the length has to stay a multiple of the block
+    // size, so ask for the whole buffer and let EOF cut it short
+    uint64_t start = read_tsc();
+    off_t got = 0;
+    while (got < to_read) {
+        ssize_t ret = pread(fd, buf + got, opts.chunk_size - got, next_offset + got);
+        if (ret == -1) {
+            perror("pread");
+            exit(EXIT_FAILURE);
+        }
+        if (ret == 0) {
+            break;
+        }
+        off_t before = got;
+        got += ret;
+        // Offset, length and buffer of the retry have to stay aligned
+        // too, so a partial O_DIRECT read is redone from its last page
+        if (opts.backend == BACKEND_DIRECT && got < to_read) {
+            got -= got % system_page_size();
+            if (got == before) {
+                fprintf(stderr, "pread: no progress at offset %ld\n", (long)(next_offset + got));
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    if (opts.latency) opts.latency->record(opts.latency_stage, read_tsc() - start);
+
+    c.start = buf;
+    c.offset = next_offset;
+    c.size = got < to_read ? got : to_read;
+    c.owner = pool.handle(buffer);
+    next_offset += to_read;
+
+    return true;
+}
+
+void PreadSource::finish() {
+    pool.free_buffers();
+}
+
+void PreadSource::print_stats() const {
+    pool.print_stats();
+}
+
+void PreadSource::report_stats(Report &r) const {
+    pool.report_stats(r);
+}
+
+ChunkSource *make_pread_source(int fd, off_t filesize, const SourceOptions &opts) {
+    return new PreadSource(fd, filesize, opts);
+}
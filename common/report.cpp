@@ -0,0 +1,236 @@
+#include "report.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+bool parse_format(const char *name, OutputFormat &format) {
+    if (strcmp(name, "text") == 0) {
+        format = FORMAT_TEXT;
+    } else if (strcmp(name, "json") == 0) {
+        format = FORMAT_JSON;
+    } else if (strcmp(name, "csv") == 0) {
+        format = FORMAT_CSV;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void Report::Section::set_raw(const std::string &key, const std::string &value, bool quoted) {
+    for (Field &f : fields) {
+        if (f.key == key) {
+            f.value = value;
+            f.quoted = quoted;
+            return;
+        }
+    }
+    fields.push_back(Field { key, value, quoted });
+}
+
+void Report::Section::set(const std::string &key, const std::string &value) {
+    set_raw(key, value, true);
+}
+
+void Report::Section::set(const std::string &key, const char *value) {
+    set_raw(key, value, true);
+}
+
+void Report::Section::set(const std::string &key, bool value) {
+    set_raw(key, value ? "true" : "false", false);
+}
+
+void Report::Section::set(const std::string &key, int value) {
+    set(key, (long)value);
+}
+
+void Report::Section::set(const std::string &key, long value) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%ld", value);
+    set_raw(key, buf, false);
+}
+
+void Report::Section::set(const std::string &key, unsigned long value) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%lu", value);
+    set_raw(key, buf, false);
+}
+
+void Report::Section::set(const std::string &key, double value) {
+    // JSON has no inf or nan
+    if (!std::isfinite(value)) {
+        set_raw(key, "null", false);
+        return;
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.9g", value);
+    set_raw(key, buf, false);
+}
+
+Report::Section &Report::section(const std::string &name) {
+    for (auto &s : sections) {
+        if (s.first == name) {
+            return s.second;
+        }
+    }
+    sections.push_back(std::make_pair(name, Section()));
+    return sections.back().second;
+}
+
+Report::Section &Report::row(const std::string &row, long id) {
+    for (auto &t : tables) {
+        if (t.first == row) {
+            return t.second[id];
+        }
+    }
+    tables.push_back(std::make_pair(row, std::map<long, Section>()));
+    return tables.back().second[id];
+}
+
+Report::Section &Report::thread(long index) {
+    return row("thread", index);
+}
+
+Report::Section &Report::worker(long tid) {
+    size_t index = 0;
+    while (index < worker_tids.size() && worker_tids[index] != tid) {
+        index++;
+    }
+    if (index == worker_tids.size()) {
+        worker_tids.push_back(tid);
+    }
+    Section &s = thread(index);
+    s.set("tid", tid);
+    return s;
+}
+
+void Report::print(OutputFormat format, bool header) const {
+    switch (format) {
+        case FORMAT_JSON:
+            print_json();
+            break;
+        case FORMAT_CSV:
+            print_csv(header);
+            break;
+        case FORMAT_TEXT:
+            break;
+    }
+}
+
+static void print_json_string(const std::string &s) {
+    putchar('"');
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            putchar('\\');
+            putchar(c);
+        } else if ((unsigned char)c < 0x20) {
+            printf("\\u%04x", c);
+        } else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+static void print_json_value(const std::string &value, bool quoted) {
+    if (quoted) {
+        print_json_string(value);
+    } else {
+        printf("%s", value.c_str());
+    }
+}
+
+void Report::print_json() const {
+    printf("{");
+    bool first = true;
+    for (const auto &s : sections) {
+        printf("%s", first ? "" : ", ");
+        print_json_string(s.first);
+        printf(": {");
+        for (size_t i = 0; i < s.second.fields.size(); i++) {
+            const Section::Field &f = s.second.fields[i];
+            printf("%s", i == 0 ? "" : ", ");
+            print_json_string(f.key);
+            printf(": ");
+            print_json_value(f.value, f.quoted);
+        }
+        printf("}");
+        first = false;
+    }
+
+    for (const auto &t : tables) {
+        printf("%s", first ? "" : ", ");
+        print_json_string(t.first + "s");
+        printf(": [");
+        bool first_row = true;
+        for (const auto &r : t.second) {
+            printf("%s{", first_row ? "" : ", ");
+            print_json_string(t.first);
+            printf(": %ld", r.first);
+            for (const Section::Field &f : r.second.fields) {
+                printf(", ");
+                print_json_string(f.key);
+                printf(": ");
+                print_json_value(f.value, f.quoted);
+            }
+            printf("}");
+            first_row = false;
+        }
+        printf("]");
+        first = false;
+    }
+    printf("}\n");
+}
+
+static void print_csv_value(const std::string &s, bool quoted) {
+    if (!quoted) {
+        printf("%s", s.c_str());
+        return;
+    }
+    putchar('"');
+    for (char c : s) {
+        if (c == '"') putchar('"');
+        putchar(c);
+    }
+    putchar('"');
+}
+
+void Report::print_csv(bool header) const {
+    bool first = true;
+    if (header) {
+        for (const auto &s : sections) {
+            for (const Section::Field &f : s.second.fields) {
+                printf("%s%s.%s", first ? "" : ",", s.first.c_str(), f.key.c_str());
+                first = false;
+            }
+        }
+        for (const auto &t : tables) {
+            for (const auto &r : t.second) {
+                for (const Section::Field &f : r.second.fields) {
+                    printf("%s%s.%ld.%s", first ? "" : ",", t.first.c_str(), r.first, f.key.c_str());
+                    first = false;
+                }
+            }
+        }
+        printf("\n");
+    }
+
+    first = true;
+    for (const auto &s : sections) {
+        for (const Section::Field &f : s.second.fields) {
+            printf("%s", first ? "" : ",");
+            print_csv_value(f.value, f.quoted);
+            first = false;
+        }
+    }
+    for (const auto &t : tables) {
+        for (const auto &r : t.second) {
+            for (const Section::Field &f : r.second.fields) {
+                printf("%s", first ? "" : ",");
+                print_csv_value(f.value, f.quoted);
+                first = false;
+            }
+        }
+    }
+    printf("\n");
+}
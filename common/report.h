@@ -0,0 +1,74 @@
+#ifndef COMMON_REPORT_H
+#define COMMON_REPORT_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum OutputFormat {
+    FORMAT_TEXT,
+    FORMAT_JSON,
+    FORMAT_CSV,
+};
+
+bool parse_format(const char *name, OutputFormat &format);
+
+// One structured record describing a whole run, for --format=json|csv.
+// Values are grouped in named sections (parameters, results, ...) and
+// in tables of rows keyed by id, such as one row per thread. JSON gets
+// one object per line, with each table as an array; CSV gets a header
+// line and a value line, with columns named section.key and
+// <row>.<id>.key. Doubles that are not finite are written as null.
+class Report {
+public:
+    class Section {
+    public:
+        void set(const std::string &key, const std::string &value);
+        void set(const std::string &key, const char *value);
+        void set(const std::string &key, bool value);
+        void set(const std::string &key, int value);
+        void set(const std::string &key, long value);
+        void set(const std::string &key, unsigned long value);
+        void set(const std::string &key, double value);
+
+    private:
+        friend class Report;
+        struct Field {
+            std::string key;
+            std::string value;
+            bool quoted;
+        };
+        void set_raw(const std::string &key, const std::string &value, bool quoted);
+
+        std::vector<Field> fields;
+    };
+
+    // Created empty on first use, printed in creation order
+    Section &section(const std::string &name);
+    // Row id of a table, printed in order of id. Rows are named row in
+    // CSV columns and JSON keys, and the table is named row + "s".
+    Section &row(const std::string &row, long id);
+    // Same as row("thread", index)
+    Section &thread(long index);
+    // Row of the thread with kernel id tid. Threads are numbered in the
+    // order they are first given here, so that columns stay the same
+    // from run to run, and the tid goes in the row as a value.
+    Section &worker(long tid);
+
+    // The CSV header line can be left out when printing many reports
+    // with the same fields
+    void print(OutputFormat format, bool header = true) const;
+
+private:
+    void print_json() const;
+    void print_csv(bool header) const;
+
+    std::vector<std::pair<std::string, Section> > sections;
+    std::vector<std::pair<std::string, std::map<long, Section> > > tables;
+    // Tid of each thread row given to worker()
+    std::vector<long> worker_tids;
+};
+
+#endif // COMMON_REPORT_H
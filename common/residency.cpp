@@ -0,0 +1,113 @@
+#include "residency.h"
+#include "report.h"
+#include "util.h"
+
+#include <cstdint>
+#include <cstdio>
+
+#include <sys/mman.h>
+
+ResidencyTracker::ResidencyTracker() {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    getrusage(RUSAGE_SELF, &start_usage);
+    end_usage = start_usage;
+}
+
+double ResidencyTracker::sample(const void *start, off_t size) {
+    size_t page = system_page_size();
+    size_t pages = (size + page - 1) / page;
+    std::vector<unsigned char> vec(pages);
+    if (mincore(const_cast<void *>(start), size, vec.data()) == -1) {
+        return -1;
+    }
+    size_t resident = 0;
+    for (unsigned char v : vec) {
+        resident += v & 1;
+    }
+    return pages > 0 ? 100.0 * resident / pages : 0;
+}
+
+int ResidencyTracker::dispatch(const void *start, off_t offset, off_t size) {
+    Region r;
+    r.offset = offset;
+    r.size = size;
+    r.dispatch_pct = sample(start, size);
+
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    r.dispatch_ns = duration_ns(this->start, now);
+    r.minor_faults = usage.ru_minflt;
+    r.major_faults = usage.ru_majflt;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    regions.push_back(r);
+    return regions.size() - 1;
+}
+
+void ResidencyTracker::complete(int region, const void *start, off_t size) {
+    double pct = sample(start, size);
+
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    Region &r = regions[region];
+    r.complete_pct = pct;
+    r.complete_ns = duration_ns(this->start, now);
+    r.minor_faults = usage.ru_minflt - r.minor_faults;
+    r.major_faults = usage.ru_majflt - r.major_faults;
+    end_usage = usage;
+}
+
+void ResidencyTracker::print_text() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    double dispatch_pct = 0, complete_pct = 0;
+    printf("Residency (region offset: ms resident%% at dispatch -> ms resident%% at completion, minor/major faults):\n");
+    for (size_t i = 0; i < regions.size(); i++) {
+        const Region &r = regions[i];
+        printf("  %zu @%ld: %.3f %.1f%% -> %.3f %.1f%%, %ld/%ld\n", i, r.offset,
+                (double)r.dispatch_ns / NSECS_IN_MSEC, r.dispatch_pct,
+                (double)r.complete_ns / NSECS_IN_MSEC, r.complete_pct,
+                r.minor_faults, r.major_faults);
+        dispatch_pct += r.dispatch_pct;
+        complete_pct += r.complete_pct;
+    }
+    if (!regions.empty()) {
+        printf("Residency at dispatch (%%): %.1f\n", dispatch_pct / regions.size());
+        printf("Residency at completion (%%): %.1f\n", complete_pct / regions.size());
+    }
+    printf("Faults (minor/major): %ld/%ld\n", end_usage.ru_minflt - start_usage.ru_minflt,
+            end_usage.ru_majflt - start_usage.ru_majflt);
+}
+
+void ResidencyTracker::report(Report &r) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    double dispatch_pct = 0, complete_pct = 0;
+    for (size_t i = 0; i < regions.size(); i++) {
+        const Region &region = regions[i];
+        Report::Section &row = r.row("region", i);
+        row.set("offset", (long)region.offset);
+        row.set("size", (long)region.size);
+        row.set("dispatch_ns", (unsigned long)region.dispatch_ns);
+        row.set("dispatch_pct", region.dispatch_pct);
+        row.set("complete_ns", (unsigned long)region.complete_ns);
+        row.set("complete_pct", region.complete_pct);
+        row.set("minor_faults", region.minor_faults);
+        row.set("major_faults", region.major_faults);
+        dispatch_pct += region.dispatch_pct;
+        complete_pct += region.complete_pct;
+    }
+
+    Report::Section &s = r.section("residency");
+    s.set("regions", (int)regions.size());
+    if (!regions.empty()) {
+        s.set("dispatch_pct", dispatch_pct / regions.size());
+        s.set("complete_pct", complete_pct / regions.size());
+    }
+    s.set("minor_faults", end_usage.ru_minflt - start_usage.ru_minflt);
+    s.set("major_faults", end_usage.ru_majflt - start_usage.ru_majflt);
+}
@@ -0,0 +1,58 @@
+#ifndef COMMON_RESIDENCY_H
+#define COMMON_RESIDENCY_H
+
+#include <mutex>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <time.h>
+
+class Report;
+
+// Page cache residency of each mapped metachunk (a region), sampled with
+// mincore() when its first chunk is dispatched and again when its last
+// chunk is released, with the page faults of the process in between.
+// Shows whether prefaulting and madvise() got the data in ahead of the
+// consumer or only moved the cost of faulting it.
+class ResidencyTracker {
+public:
+    ResidencyTracker();
+
+    // Returns the region id to pass to complete()
+    int dispatch(const void *start, off_t offset, off_t size);
+    void complete(int region, const void *start, off_t size);
+
+    // One line per region, then means and fault totals
+    void print_text() const;
+    // Same, as a "region" table and a "residency" section
+    void report(Report &r) const;
+
+private:
+    struct Region {
+        off_t offset;
+        off_t size;
+        // Nanoseconds since the tracker was created
+        uint64_t dispatch_ns;
+        uint64_t complete_ns = 0;
+        // Percent of the pages in core
+        double dispatch_pct;
+        double complete_pct = -1;
+        // Counts at dispatch, then differences at completion. Faults are
+        // process-wide, so regions in flight at the same time share them.
+        long minor_faults;
+        long major_faults;
+    };
+
+    static double sample(const void *start, off_t size);
+
+    timespec start;
+    struct rusage start_usage;
+    // At the last completion, for the totals
+    struct rusage end_usage;
+
+    mutable std::mutex mutex;
+    std::vector<Region> regions;
+};
+
+#endif // COMMON_RESIDENCY_H
@@ -0,0 +1,12 @@
+#ifndef COMMON_SOURCES_H
+#define COMMON_SOURCES_H
+
+#include "chunk_source.h"
+
+// Backend implementations, use make_chunk_source() instead
+ChunkSource *make_mmap_source(int fd, off_t filesize, const SourceOptions &opts);
+ChunkSource *make_pread_source(int fd, off_t filesize, const SourceOptions &opts);
+ChunkSource *make_splice_source(int fd, off_t filesize, const SourceOptions &opts);
+ChunkSource *make_uring_source(int fd, off_t filesize, const SourceOptions &opts);
+
+#endif // COMMON_SOURCES_H
@@ -0,0 +1,120 @@
+#include "sources.h"
+#include "buffer_pool.h"
+#include "histogram.h"
+#include "report.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+// Moves file pages into a pipe with splice, then drains the pipe into a
+// pool of buffers with vmsplice
+class SpliceSource : public ChunkSource {
+public:
+    SpliceSource(int fd, off_t filesize, const SourceOptions &opts);
+    ~SpliceSource();
+    void print_stats() const;
+    void report_stats(Report &r) const;
+    void finish();
+
+protected:
+    bool read_next(Chunk &c);
+
+private:
+    int fd;
+    int pipefd[2];
+    off_t pipe_size;
+    SourceOptions opts;
+    BufferPool pool;
+    off_t next_offset = 0;
+};
+
+SpliceSource::SpliceSource(int fd, off_t filesize, const SourceOptions &opts)
+    : ChunkSource(filesize), fd(fd), opts(opts), pool(opts.held, opts.chunk_size, opts.huge_pages) {
+    if (pipe(pipefd) == -1) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+    // Try to fit a whole chunk in the pipe, the kernel may cap it
+    // to /proc/sys/fs/pipe-max-size
+    fcntl(pipefd[1], F_SETPIPE_SZ, (int)opts.chunk_size);
+    pipe_size = fcntl(pipefd[1], F_GETPIPE_SZ);
+    if (pipe_size <= 0) {
+        perror("fcntl F_GETPIPE_SZ");
+        exit(EXIT_FAILURE);
+    }
+}
+
+SpliceSource::~SpliceSource() {
+    close(pipefd[0]);
+    close(pipefd[1]);
+    close(fd);
+}
+
+bool SpliceSource::read_next(Chunk &c) {
+    if (next_offset >= size) {
+        return false;
+    }
+
+    int buffer = pool.acquire(true);
+    uint8_t *buf = pool.data(buffer);
+    off_t remaining = size - next_offset;
+    off_t to_read = remaining > opts.chunk_size ? opts.chunk_size : remaining;
+
+    uint64_t start = read_tsc();
+    off_t got = 0;
+    while (got < to_read) {
+        off_t left = to_read - got;
+        loff_t offset = next_offset + got;
+        ssize_t in = splice(fd, &offset, pipefd[1], NULL,
+                left > pipe_size ? pipe_size : left, SPLICE_F_MOVE);
+        if (in == -1) {
+            perror("splice");
+            exit(EXIT_FAILURE);
+        }
+        if (in == 0) {
+            break;
+        }
+
+        // Drain what was just spliced
+        while (in > 0) {
+            struct iovec iov = { buf + got, (size_t)in };
+            ssize_t out = vmsplice(pipefd[0], &iov, 1, 0);
+            if (out == -1) {
+                perror("vmsplice");
+                exit(EXIT_FAILURE);
+            }
+            got += out;
+            in -= out;
+        }
+    }
+
+    if (opts.latency) opts.latency->record(opts.latency_stage, read_tsc() - start);
+
+    c.start = buf;
+    c.offset = next_offset;
+    c.size = got;
+    c.owner = pool.handle(buffer);
+    next_offset += to_read;
+
+    return true;
+}
+
+void SpliceSource::finish() {
+    pool.free_buffers();
+}
+
+void SpliceSource::print_stats() const {
+    pool.print_stats();
+}
+
+void SpliceSource::report_stats(Report &r) const {
+    pool.report_stats(r);
+}
+
+ChunkSource *make_splice_source(int fd, off_t filesize, const SourceOptions &opts) {
+    return new SpliceSource(fd, filesize, opts);
+}
@@ -0,0 +1,165 @@
+#include "sources.h"
+#include "buffer_pool.h"
+#include "histogram.h"
+#include "report.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include <liburing.h>
+
+// Reads the file in chunk-sized pieces with io_uring, into a pool of
+// registered, page-aligned buffers. fd is expected to be opened with
+// O_DIRECT. Completions come back in any order.
+class UringSource : public ChunkSource {
+public:
+    UringSource(int fd, off_t filesize, const SourceOptions &opts);
+    ~UringSource();
+    void print_stats() const;
+    void report_stats(Report &r) const;
+    void finish();
+
+protected:
+    bool read_next(Chunk &c);
+
+private:
+    void submit();
+
+    int fd;
+    SourceOptions opts;
+    // Enough buffers to keep the queue full while
+    // the consumer holds as many as it can
+    BufferPool pool;
+    struct io_uring ring;
+    std::vector<off_t> offsets;
+    // Submission time of the read into each buffer
+    std::vector<uint64_t> submitted;
+    off_t next_offset = 0;
+    int inflight = 0;
+    // Ring torn down by finish()
+    bool finished = false;
+};
+
+UringSource::UringSource(int fd, off_t filesize, const SourceOptions &opts)
+    : ChunkSource(filesize), fd(fd), opts(opts),
+      pool(opts.queue_depth + opts.held, opts.chunk_size, opts.huge_pages), offsets(pool.count()), submitted(pool.count()) {
+    int ret = io_uring_queue_init(opts.queue_depth, &ring, 0);
+    if (ret < 0) {
+        fprintf(stderr, "io_uring_queue_init: %s\n", strerror(-ret));
+        exit(EXIT_FAILURE);
+    }
+
+    std::vector<struct iovec> iovecs(pool.count());
+    for (int i = 0; i < pool.count(); i++) {
+        iovecs[i].iov_base = pool.data(i);
+        iovecs[i].iov_len = pool.buffer_size();
+    }
+    ret = io_uring_register_buffers(&ring, iovecs.data(), iovecs.size());
+    if (ret < 0) {
+        fprintf(stderr, "io_uring_register_buffers: %s\n", strerror(-ret));
+        exit(EXIT_FAILURE);
+    }
+}
+
+UringSource::~UringSource() {
+    if (!finished) {
+        io_uring_unregister_buffers(&ring);
+        io_uring_queue_exit(&ring);
+    }
+    close(fd);
+}
+
+void UringSource::finish() {
+    if (finished) {
+        return;
+    }
+    io_uring_unregister_buffers(&ring);
+    io_uring_queue_exit(&ring);
+    pool.free_buffers();
+    finished = true;
+}
+
+void UringSource::submit() {
+    int queued = 0;
+    while (inflight < opts.queue_depth && next_offset < size) {
+        // Only block on a buffer when there is no completion to wait for
+        int buffer = pool.acquire(inflight == 0);
+        if (buffer == -1) {
+            break;
+        }
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+        io_uring_prep_read_fixed(sqe, fd, pool.data(buffer), opts.chunk_size, next_offset, buffer);
+        io_uring_sqe_set_data64(sqe, buffer);
+        offsets[buffer] = next_offset;
+        submitted[buffer] = read_tsc();
+        next_offset += opts.chunk_size;
+        inflight++;
+        queued++;
+    }
+
+    if (queued > 0) {
+        int ret = io_uring_submit(&ring);
+        if (ret < 0) {
+            fprintf(stderr, "io_uring_submit: %s\n", strerror(-ret));
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+bool UringSource::read_next(Chunk &c) {
+    submit();
+    if (inflight == 0) {
+        return false;
+    }
+
+    struct io_uring_cqe *cqe;
+    int ret = io_uring_wait_cqe(&ring, &cqe);
+    if (ret < 0) {
+        fprintf(stderr, "io_uring_wait_cqe: %s\n", strerror(-ret));
+        exit(EXIT_FAILURE);
+    }
+    int buffer = io_uring_cqe_get_data64(cqe);
+    int res = cqe->res;
+    io_uring_cqe_seen(&ring, cqe);
+    inflight--;
+
+    if (res < 0) {
+        fprintf(stderr, "read: %s\n", strerror(-res));
+        exit(EXIT_FAILURE);
+    }
+    // Only the last chunk of the file can come back short, anything else
+    // would leave a hole in what the pipeline sees
+    off_t expected = size - offsets[buffer] > opts.chunk_size ? opts.chunk_size : size - offsets[buffer];
+    if (res < expected) {
+        fprintf(stderr, "read: short read of %d bytes at offset %ld, expected %ld\n",
+                res, (long)offsets[buffer], (long)expected);
+        exit(EXIT_FAILURE);
+    }
+
+    if (opts.latency) opts.latency->record(opts.latency_stage, read_tsc() - submitted[buffer]);
+
+    c.start = pool.data(buffer);
+    c.offset = offsets[buffer];
+    c.size = res;
+    c.owner = pool.handle(buffer);
+    return true;
+}
+
+void UringSource::print_stats() const {
+    printf("Queue depth: %d\n", opts.queue_depth);
+    pool.print_stats();
+}
+
+void UringSource::report_stats(Report &r) const {
+    r.section("source").set("queue_depth", opts.queue_depth);
+    pool.report_stats(r);
+}
+
+ChunkSource *make_uring_source(int fd, off_t filesize, const SourceOptions &opts) {
+    return new UringSource(fd, filesize, opts);
+}
@@ -0,0 +1,128 @@
+#include "util.h"
+#include "report.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const size_t DEFAULT_HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+size_t system_page_size() {
+    static const size_t size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+static size_t read_huge_page_size() {
+    size_t size = DEFAULT_HUGE_PAGE_SIZE;
+    FILE *f = fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r");
+    if (f) {
+        if (fscanf(f, "%zu", &size) != 1 || size == 0) {
+            size = DEFAULT_HUGE_PAGE_SIZE;
+        }
+        fclose(f);
+    }
+    return size;
+}
+
+size_t huge_page_size() {
+    static const size_t size = read_huge_page_size();
+    return size;
+}
+
+off_t round_up(off_t size, off_t align) {
+    return (size + align - 1) / align * align;
+}
+
+off_t get_filesize(int fd) {
+    struct stat stats;
+    off_t ret = -1;
+    if (fstat(fd, &stats) == 0) {
+        ret = stats.st_size;
+    }
+
+    return ret;
+}
+
+std::vector<std::string> expand_inputs(const std::vector<std::string> &paths) {
+    std::vector<std::string> files;
+    for (const std::string &path : paths) {
+        struct stat stats;
+        if (stat(path.c_str(), &stats) == -1) {
+            fprintf(stderr, "Error: cannot open file %s: %s\n", path.c_str(), strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (!S_ISDIR(stats.st_mode)) {
+            files.push_back(path);
+            continue;
+        }
+
+        DIR *dir = opendir(path.c_str());
+        if (dir == NULL) {
+            fprintf(stderr, "Error: cannot open directory %s: %s\n", path.c_str(), strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        std::vector<std::string> entries;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            std::string file = path + "/" + entry->d_name;
+            if (entry->d_name[0] != '.' && stat(file.c_str(), &stats) == 0 && S_ISREG(stats.st_mode)) {
+                entries.push_back(file);
+            }
+        }
+        closedir(dir);
+        std::sort(entries.begin(), entries.end());
+        files.insert(files.end(), entries.begin(), entries.end());
+    }
+    return files;
+}
+
+struct timespec time_diff(struct timespec start, struct timespec end) {
+    struct timespec ret;
+    if ((end.tv_nsec - start.tv_nsec) < 0) {
+        ret.tv_sec = end.tv_sec - start.tv_sec - 1;
+        ret.tv_nsec = NSECS_IN_SEC + end.tv_nsec - start.tv_nsec;
+    } else {
+        ret.tv_sec = end.tv_sec - start.tv_sec;
+        ret.tv_nsec = end.tv_nsec - start.tv_nsec;
+    }
+    return ret;
+}
+
+double to_seconds(struct timespec t) {
+    return (double)t.tv_sec + ((double)t.tv_nsec / (double)NSECS_IN_SEC);
+}
+
+uint64_t duration_ns(struct timespec start, struct timespec end) {
+    struct timespec diff = time_diff(start, end);
+    return (uint64_t)diff.tv_sec * NSECS_IN_SEC + diff.tv_nsec;
+}
+
+void print_results(off_t bytes, struct timespec diff) {
+    double time = to_seconds(diff);
+    printf("Time (s): %ld.%03ld\n", diff.tv_sec, diff.tv_nsec / NSECS_IN_MSEC);
+    printf("Bandwidth (MB/s): %f\n", ((double)bytes/time)/(double)BYTES_IN_MBYTE);
+}
+
+void report_results(Report &r, off_t bytes, struct timespec diff) {
+    double time = to_seconds(diff);
+    Report::Section &s = r.section("results");
+    s.set("elapsed_ns", (unsigned long)diff.tv_sec * NSECS_IN_SEC + diff.tv_nsec);
+    s.set("bytes", (long)bytes);
+    s.set("bandwidth_mbps", ((double)bytes/time)/(double)BYTES_IN_MBYTE);
+}
+
+void print_iops(uint64_t accesses, struct timespec diff) {
+    printf("IOPS (pages/s): %f\n", (double)accesses / to_seconds(diff));
+}
+
+void report_iops(Report &r, uint64_t accesses, struct timespec diff) {
+    Report::Section &s = r.section("results");
+    s.set("page_accesses", (unsigned long)accesses);
+    s.set("iops", (double)accesses / to_seconds(diff));
+}
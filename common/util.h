@@ -0,0 +1,49 @@
+#ifndef COMMON_UTIL_H
+#define COMMON_UTIL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+class Report;
+
+// Unit of work of the benchmarks: kernels touch and IOPS count pages of
+// this size, whatever the page size of the machine
+static const int PAGE_SIZE = 4096;
+
+static const int BYTES_IN_MBYTE = 1000000;
+static const int BYTES_IN_GBYTE = 1000000000;
+static const int NSECS_IN_MSEC = 1000000;
+static const int NSECS_IN_SEC = 1000000000;
+
+// Page size of the machine, which mmap offsets and mincore() go by
+size_t system_page_size();
+// Size of a transparent huge page, 2 MiB if the kernel does not say
+size_t huge_page_size();
+// Rounds size up to a multiple of align
+off_t round_up(off_t size, off_t align);
+
+// Returns the size of the file behind fd, or -1 on error
+off_t get_filesize(int fd);
+
+// Replaces each directory by the regular files it contains, sorted by
+// name (the stream files of a trace). Exits if a path cannot be read.
+std::vector<std::string> expand_inputs(const std::vector<std::string> &paths);
+
+struct timespec time_diff(struct timespec start, struct timespec end);
+double to_seconds(struct timespec t);
+uint64_t duration_ns(struct timespec start, struct timespec end);
+
+// Prints elapsed time and bandwidth for a run that read bytes
+void print_results(off_t bytes, struct timespec diff);
+// Same, in the "results" section of a report, with the time in nanoseconds
+void report_results(Report &r, off_t bytes, struct timespec diff);
+
+// Prints page accesses per second, each access being one page of the file
+void print_iops(uint64_t accesses, struct timespec diff);
+void report_iops(Report &r, uint64_t accesses, struct timespec diff);
+
+#endif // COMMON_UTIL_H
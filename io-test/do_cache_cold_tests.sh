@@ -1,12 +1,6 @@
 #!/bin/bash
 
 main() {
-    if [[ $EUID -ne 0 ]]
-    then
-        echo "Must be root to flush cache"
-        return
-    fi
-
     local large_file=large_file
     local program=./io-test
     local args=
@@ -24,13 +18,13 @@ main() {
     fi
 
     echo -e "${blue}Testing cache cold best case${NC}"
-    args="-t 1 -i 1 -c 8192000"
-    ../scripts/cache_cold.sh $program $args $large_file
+    args="--cold -t 1 -i 1 -c 8192000"
+    $program $args $large_file
     echo -e $separator
 
     echo -e "${blue}Testing cache cold worst case${NC}"
-    args="-w -t 1 -i 1 -c 8192000"
-    ../scripts/cache_cold.sh $program $args $large_file
+    args="--cold -w -t 1 -i 1 -c 8192000"
+    $program $args $large_file
     echo $separator
 
     echo -e "${red}Testing cache hot${NC}"
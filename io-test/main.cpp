@@ -0,0 +1,760 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#include <stdint.h>
+#include <x86intrin.h>
+#include <pthread.h>
+#include <time.h>
+#include <omp.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <sys/mman.h>
+
+#include <papi.h>
+#include <getopt.h>
+
+#include "access_pattern.h"
+#include "affinity.h"
+#include "chunk_source.h"
+#include "histogram.h"
+#include "iotrace.h"
+#include "kernels.h"
+#include "page_cache.h"
+#include "perf_counters.h"
+#include "report.h"
+#include "residency.h"
+#include "util.h"
+
+#include "steal.h"
+
+#include "tp.h"
+
+#define PROGNAME "io-test"
+
+#define NUM_EVENTS 1
+
+static const char *const progname = PROGNAME;
+static const int MY_PAGE_SIZE = PAGE_SIZE;
+static const int DEFAULT_ITERATIONS = 10000;
+static const int DEFAULT_CHUNK_SIZE = 2048 * MY_PAGE_SIZE;
+static const int DEFAULT_THREADS = 1;
+static const int DEFAULT_QUEUE_DEPTH = 8;
+static const int DEFAULT_GRAIN = 16;
+
+enum Schedule {
+    // Threads split each chunk with omp for, then wait for each other
+    SCHEDULE_CHUNK,
+    // Page ranges on per-thread deques with stealing, no barrier
+    SCHEDULE_STEAL,
+};
+
+struct vars {
+    char *filename;
+    int iterations;
+    int threads;
+    off_t chunk_size;
+    Backend backend;
+    int queue_depth;
+    PatternOptions pattern;
+    bool pattern_set;
+    Schedule schedule;
+    // Pages per task with SCHEDULE_STEAL
+    int grain;
+    Kernel kernel;
+    Isa isa;
+    bool isa_set;
+    bool verbose;
+    bool worst_case;
+    bool prefault;
+    bool huge_pages;
+    Affinity affinity;
+    bool membind;
+    bool counters;
+    bool cold;
+    bool residency;
+    OutputFormat format;
+};
+
+// Filled in by each OpenMP thread, indexed by thread number
+struct thread_stats {
+    bool active = false;
+    int pages = 0;
+    // More than the file with the zipfian pattern, which revisits pages
+    uint64_t bytes = 0;
+    long long instructions = 0;
+    uint64_t dtlb_misses = 0;
+    uint64_t sum = 0;
+    uint64_t kernel_time = 0;
+    uint64_t steals = 0;
+};
+
+__attribute__((noreturn))
+static void usage(void) {
+    fprintf(stderr, "Usage: %s [OPTIONS] file\n", progname);
+    fprintf(stderr, "\nOptions:\n\n");
+    fprintf(stderr, "  --iterations, -i     set number of iterations per page\n");
+    fprintf(stderr, "  --chunk-size, -c     set size of chunks\n");
+    fprintf(stderr, "  --threads, -t        set number of threads\n");
+    fprintf(stderr, "  --backend, -b        read with mmap (default), pread, direct, splice or uring\n");
+    fprintf(stderr, "  --queue-depth, -q    set number of reads in flight with uring\n");
+    fprintf(stderr, "  --schedule, -s       split chunks between threads with chunk (default) or steal\n");
+    fprintf(stderr, "  --grain, -g          set number of pages per task with steal\n");
+    fprintf(stderr, "  --kernel, -k         set work done on pages: touch (default), crc32c, histogram or scan\n");
+    fprintf(stderr, "  --isa, -x            limit kernel to scalar, sse2, sse4.2, avx2 or avx512\n");
+    fprintf(stderr, "  --pattern, -a        visit pages in sequential (default), random, strided or zipfian order\n");
+    fprintf(stderr, "  --seed, -e           set seed of the access pattern\n");
+    fprintf(stderr, "  --stride, -y         set stride of the strided pattern, in pages\n");
+    fprintf(stderr, "  --skew, -z           set exponent of the zipfian pattern\n");
+    fprintf(stderr, "  --worst-case, -w     map the whole file at once and visit pages in random order\n");
+    fprintf(stderr, "  --prefault, -p       prefault pages when reading file\n");
+    fprintf(stderr, "  --huge-pages, -H     map on huge page boundaries with transparent huge pages,\n");
+    fprintf(stderr, "                       or use huge page read buffers with other backends\n");
+    fprintf(stderr, "  --affinity, -A       pin threads: none (default), compact, scatter or numa\n");
+    fprintf(stderr, "  --membind, -M        fault chunks in from the threads processing them, on their node\n");
+    fprintf(stderr, "                       (implies numa)\n");
+    fprintf(stderr, "  --counters, -C       collect hardware counters per thread, dTLB misses included\n");
+    fprintf(stderr, "  --residency-report, -r  sample page cache residency of each chunk (mmap only)\n");
+    fprintf(stderr, "  --cold, -d           evict the file from the page cache first (no root needed)\n");
+    fprintf(stderr, "  --format, -o         print results as text (default), json or csv\n");
+    fprintf(stderr, "  --verbose, -v        set verbose output\n");
+    exit(EXIT_FAILURE);
+}
+
+static void parse_opts(int argc, char **argv, struct vars *vars) {
+    int opt;
+    size_t loadpathlen = 0;
+
+    struct option options[] = {
+        { "help",   0, 0, 'h' },
+        { "verbose",   0, 0, 'v' },
+        { "worst-case",   0, 0, 'w' },
+        { "prefault",   0, 0, 'p' },
+        { "huge-pages",   0, 0, 'H' },
+        { "counters",   0, 0, 'C' },
+        { "membind",   0, 0, 'M' },
+        { "affinity",   1, 0, 'A' },
+        { "cold",   0, 0, 'd' },
+        { "residency-report",   0, 0, 'r' },
+        { "iterations",   1, 0, 'i' },
+        { "chunk-size",   1, 0, 'c' },
+        { "threads",   1, 0, 't' },
+        { "backend",   1, 0, 'b' },
+        { "queue-depth",   1, 0, 'q' },
+        { "schedule",   1, 0, 's' },
+        { "grain",   1, 0, 'g' },
+        { "pattern",   1, 0, 'a' },
+        { "seed",   1, 0, 'e' },
+        { "stride",   1, 0, 'y' },
+        { "skew",   1, 0, 'z' },
+        { "kernel",   1, 0, 'k' },
+        { "isa",   1, 0, 'x' },
+        { "format",   1, 0, 'o' },
+        { 0, 0, 0, 0 },
+    };
+    int idx;
+
+    while ((opt = getopt_long(argc, argv, "hvwpHCMdrA:i:t:c:b:q:s:g:a:e:y:z:k:x:o:", options, &idx)) != -1) {
+        switch (opt) {
+            case 'i':
+                vars->iterations = atoi(optarg);
+                break;
+            case 't':
+                vars->threads = atoi(optarg);
+                break;
+            case 'c':
+                vars->chunk_size = atoi(optarg);
+                break;
+            case 'b':
+                if (!parse_backend(optarg, vars->backend)) {
+                    fprintf(stderr, "Unknown backend: %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'q':
+                vars->queue_depth = atoi(optarg);
+                break;
+            case 's':
+                if (strcmp(optarg, "chunk") == 0) {
+                    vars->schedule = SCHEDULE_CHUNK;
+                } else if (strcmp(optarg, "steal") == 0) {
+                    vars->schedule = SCHEDULE_STEAL;
+                } else {
+                    fprintf(stderr, "Unknown schedule: %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'g':
+                vars->grain = atoi(optarg);
+                if (vars->grain <= 0) {
+                    fprintf(stderr, "Invalid grain: %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'a':
+                if (!parse_pattern(optarg, vars->pattern.pattern)) {
+                    fprintf(stderr, "Unknown access pattern: %s\n", optarg);
+                    usage();
+                }
+                vars->pattern_set = true;
+                break;
+            case 'e':
+                vars->pattern.seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'y':
+                vars->pattern.stride = atol(optarg);
+                break;
+            case 'z':
+                vars->pattern.skew = atof(optarg);
+                if (!(vars->pattern.skew > 0)) {
+                    fprintf(stderr, "Invalid skew: %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'k':
+                if (!parse_kernel(optarg, vars->kernel)) {
+                    fprintf(stderr, "Unknown kernel: %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'x':
+                if (!parse_isa(optarg, vars->isa)) {
+                    fprintf(stderr, "Unknown instruction set: %s\n", optarg);
+                    usage();
+                }
+                vars->isa_set = true;
+                break;
+            case 'o':
+                if (!parse_format(optarg, vars->format)) {
+                    fprintf(stderr, "Unknown output format: %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'v':
+                vars->verbose = true;
+                break;
+            case 'w':
+                vars->worst_case = true;
+                break;
+            case 'p':
+                vars->prefault = true;
+                break;
+            case 'H':
+                vars->huge_pages = true;
+                break;
+            case 'C':
+                vars->counters = true;
+                break;
+            case 'M':
+                vars->membind = true;
+                break;
+            case 'A':
+                if (!parse_affinity(optarg, vars->affinity)) {
+                    fprintf(stderr, "Unknown affinity: %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'd':
+                vars->cold = true;
+                break;
+            case 'r':
+                vars->residency = true;
+                break;
+            case 'h':
+                usage();
+                break;
+            default:
+                usage();
+                break;
+        }
+    }
+
+    // Non-option arg for filename
+    if (optind >= argc) {
+        fprintf(stderr, "File name missing.\n");
+        usage();
+    } else {
+        vars->filename = argv[optind];
+    }
+
+    // Worst case makes the whole file one chunk, which copy backends
+    // would have to read into whole-file buffers
+    if (vars->worst_case && vars->backend != BACKEND_MMAP) {
+        fprintf(stderr, "Worst case needs the mmap backend\n");
+        usage();
+    }
+
+    // Default values
+    if (vars->iterations == 0) {
+        vars->iterations = DEFAULT_ITERATIONS;
+        if (vars->verbose) {
+            printf("using default iterations: %d\n", vars->iterations);
+        }
+    }
+
+    if (vars->threads == 0) {
+        vars->threads = DEFAULT_THREADS;
+        if (vars->verbose) {
+            printf("using default threads: %d\n", vars->threads);
+        }
+    }
+
+    if (!vars->isa_set) {
+        vars->isa = detect_isa();
+        if (vars->verbose) {
+            printf("using default instruction set: %s\n", isa_name(vars->isa));
+        }
+    }
+
+    if (vars->membind && vars->affinity == AFFINITY_NONE) {
+        vars->affinity = AFFINITY_NUMA;
+        if (vars->verbose) {
+            printf("using membind affinity: %s\n", affinity_name(vars->affinity));
+        }
+    }
+
+    if (vars->queue_depth == 0) {
+        vars->queue_depth = DEFAULT_QUEUE_DEPTH;
+        if (vars->verbose) {
+            printf("using default queue depth: %d\n", vars->queue_depth);
+        }
+    }
+
+    if (vars->grain == 0) {
+        vars->grain = DEFAULT_GRAIN;
+        if (vars->verbose) {
+            printf("using default grain: %d\n", vars->grain);
+        }
+    }
+
+    if (!vars->pattern_set && vars->worst_case) {
+        vars->pattern.pattern = PATTERN_RANDOM;
+        if (vars->verbose) {
+            printf("using worst case pattern: %s\n", pattern_name(vars->pattern.pattern));
+        }
+    }
+
+    if (vars->chunk_size == 0 && !vars->worst_case) {
+        vars->chunk_size = DEFAULT_CHUNK_SIZE;
+        if (vars->verbose) {
+            printf("using default chunk size: %ld\n", vars->chunk_size);
+        }
+    }
+}
+
+// Runs the kernel over one page of a chunk, timing it if latency is set.
+// The bytes it went through are added to bytes.
+static inline uint64_t visit_page(KernelFunc kernel, uint8_t *chunk_start, off_t chunk_size,
+        uint64_t page, int iterations, StageHistograms *latency, uint64_t &bytes) {
+    off_t offset = page * MY_PAGE_SIZE;
+    off_t remaining = chunk_size - offset;
+    off_t size = remaining > MY_PAGE_SIZE ? MY_PAGE_SIZE : remaining;
+    uint64_t start = latency ? read_tsc() : 0;
+    uint64_t ret = kernel(chunk_start + offset, size, iterations);
+    if (latency) latency->record(0, read_tsc() - start);
+    bytes += size;
+    return ret;
+}
+
+// Runs the kernel once over count pages of a chunk from page first, for
+// the sequential pattern
+static inline uint64_t visit_pages(KernelFunc kernel, uint8_t *chunk_start, off_t chunk_size,
+        uint64_t first, uint64_t count, int iterations, uint64_t &bytes) {
+    off_t offset = first * MY_PAGE_SIZE;
+    off_t end = (first + count) * MY_PAGE_SIZE;
+    off_t size = (end < chunk_size ? end : chunk_size) - offset;
+    bytes += size;
+    return kernel(chunk_start + offset, size, iterations);
+}
+
+int main(int argc, char **argv) {
+    tracepoint(tracekit, begin);
+    int fd;
+    off_t length;
+    int pages;
+    struct timespec start, end;
+
+    volatile uint64_t sum = 0;
+    uint64_t kernel_time = 0;
+    KernelFunc kernel;
+
+    struct vars *vars = new struct vars();
+    parse_opts(argc, argv, vars);
+
+    setlocale(LC_NUMERIC, "");
+
+    fd = open(vars->filename, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Error: cannot open file %s\n", vars->filename);
+        exit(EXIT_FAILURE);
+    }
+
+    length = get_filesize(fd);
+    if (length == -1) {
+        fprintf(stderr, "Error: cannot get file size.\n");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    if (vars->chunk_size == -1 || vars->worst_case) {
+        vars->chunk_size = length;
+    }
+
+    // Chunks are mapped one at a time, so with huge pages they have to
+    // start on a huge page boundary of the file to be backed by them
+    off_t align = system_page_size();
+    if (vars->huge_pages && vars->backend == BACKEND_MMAP) {
+        align = huge_page_size();
+    }
+    if (vars->chunk_size % align != 0) {
+        vars->chunk_size = round_up(vars->chunk_size, align);
+        printf("Growing chunk size to nearest %spage multiple: %'jd\n",
+                align > (off_t)system_page_size() ? "huge " : "", vars->chunk_size);
+    }
+
+    // Chunks are mapped once and shared by all threads. With stealing,
+    // each thread can be working on a different chunk.
+    SourceOptions opts;
+    opts.backend = vars->backend;
+    opts.chunk_size = vars->chunk_size;
+    opts.meta_chunk_size = vars->chunk_size;
+    opts.window = vars->schedule == SCHEDULE_STEAL ? vars->threads + 1 : 2;
+    opts.prefetch = 0;
+    opts.huge_pages = vars->huge_pages;
+    // Under the chunk schedule, chunks are taken by one thread and then
+    // shared, so each thread faults in its own share instead, and the
+    // mapping must not be populated up front
+    bool share_faults = vars->membind && vars->backend == BACKEND_MMAP && vars->schedule == SCHEDULE_CHUNK;
+    opts.consumer_faults = vars->membind && vars->schedule == SCHEDULE_STEAL;
+    opts.prefault = vars->prefault && !share_faults;
+    opts.advice = vars->worst_case ? MADV_RANDOM : MADV_SEQUENTIAL;
+    opts.queue_depth = vars->queue_depth;
+    opts.held = vars->schedule == SCHEDULE_STEAL ? vars->threads : 1;
+
+    kernel = select_kernel(vars->kernel, vars->isa, vars->isa);
+
+    pages = length / MY_PAGE_SIZE;
+    if (vars->verbose) {
+        printf("pages=%d\n", pages);
+    }
+
+    // Initialize PAPI
+    int events[NUM_EVENTS] = {PAPI_TOT_INS};
+
+    PAPI_library_init(PAPI_VER_CURRENT);
+    PAPI_thread_init(pthread_self);
+
+    omp_set_num_threads(vars->threads);
+    std::vector<thread_stats> stats(vars->threads);
+
+    Eviction eviction;
+    if (vars->cold) {
+        eviction = evict_file(vars->filename);
+    }
+
+    // Per-page latency is the point of a pattern
+    StageHistograms *latency = NULL;
+    if (vars->pattern.pattern != PATTERN_SEQUENTIAL) {
+        latency = new StageHistograms({ "page" });
+    }
+
+    // Thread i of the parallel region is worker i
+    CpuPlacement placement(vars->affinity, vars->membind);
+    NodeTraffic *traffic = NULL;
+    if (vars->affinity != AFFINITY_NONE) {
+        traffic = new NodeTraffic();
+    }
+
+    PerfCounters *counters = NULL;
+    if (vars->counters) {
+        counters = new PerfCounters({ "process" });
+    }
+
+    ResidencyTracker *residency = NULL;
+    if (vars->residency) {
+        if (vars->backend != BACKEND_MMAP) {
+            fprintf(stderr, "Residency report only covers the mmap backend\n");
+        }
+        residency = new ResidencyTracker();
+        opts.residency = residency;
+    }
+
+    // Set up before the clock starts, only reading is timed, and so is
+    // drawing the order of the pages (of the whole file with -w)
+    ChunkSource *source = make_chunk_source(vars->filename, opts);
+    PageOrders orders(vars->pattern, length, vars->chunk_size);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    Chunk chunk;
+    PageOrder order;
+    uint64_t count = 0;
+    bool more = true;
+    StealingScheduler scheduler(*source, vars->threads, vars->grain, orders);
+
+#ifndef NO_OMP
+#pragma omp parallel reduction(+:sum,kernel_time)
+#endif
+    {
+        int i;
+        struct timespec kernel_start, kernel_end;
+        long long int values[NUM_EVENTS];
+        int pages = 0;
+        uint64_t bytes = 0;
+        int iterations = vars->iterations;
+
+        placement.pin(omp_get_thread_num());
+
+        CounterValues counters_begin;
+        if (counters) counters_begin = counters->read();
+        PAPI_start_counters(events, NUM_EVENTS);
+        PageTask task;
+        while (vars->schedule == SCHEDULE_STEAL && scheduler.next(omp_get_thread_num(), task)) {
+            iotrace(process_begin, task.chunk_id, iotrace_tid());
+            clock_gettime(CLOCK_MONOTONIC, &kernel_start);
+            if (task.order) {
+                for (uint64_t j = task.first; j < task.first + task.count; j++) {
+                    sum += visit_page(kernel, task.chunk_start, task.chunk_size, (*task.order)[j], iterations, latency, bytes);
+                }
+            } else {
+                sum += visit_pages(kernel, task.chunk_start, task.chunk_size, task.first, task.count, iterations, bytes);
+            }
+            pages += task.count;
+            clock_gettime(CLOCK_MONOTONIC, &kernel_end);
+            if (traffic) {
+                uint64_t first = task.order ? (*task.order)[task.first] : task.first;
+                traffic->add(task.chunk_start + first * MY_PAGE_SIZE, task.count * MY_PAGE_SIZE);
+            }
+            kernel_time += duration_ns(kernel_start, kernel_end);
+            iotrace(process_end, task.chunk_id, iotrace_tid());
+            // Last task of a chunk unmaps it
+            task = PageTask();
+        }
+
+        while (vars->schedule == SCHEDULE_CHUNK) {
+#ifndef NO_OMP
+#pragma omp single
+#endif
+            {
+                // Drop the previous chunk before asking for the next one
+                chunk = Chunk();
+                more = source->next(chunk);
+                count = (chunk.size + MY_PAGE_SIZE - 1) / MY_PAGE_SIZE;
+                order = more ? orders.of(chunk.offset) : NULL;
+                if (order) {
+                    count = order->size();
+                }
+            }
+            if (!more) {
+                break;
+            }
+
+            // This thread's contiguous share of the chunk
+            int nthreads = omp_get_num_threads();
+            int thread = omp_get_thread_num();
+            uint64_t npages = (chunk.size + MY_PAGE_SIZE - 1) / MY_PAGE_SIZE;
+            uint64_t share_first = npages * thread / nthreads;
+            uint64_t share_pages = npages * (thread + 1) / nthreads - share_first;
+            if (share_faults && share_pages > 0) {
+                off_t offset = share_first * MY_PAGE_SIZE;
+                off_t end = (share_first + share_pages) * MY_PAGE_SIZE;
+                fault_in(chunk.start + offset, (end < chunk.size ? end : chunk.size) - offset, vars->prefault);
+            }
+            if (share_faults && order) {
+                // Pages are visited by any thread, so every share is
+                // faulted in by its owner first
+#ifndef NO_OMP
+#pragma omp barrier
+#endif
+            }
+
+            // What this thread visited, for NodeTraffic
+            uint64_t chunk_first = 0;
+            uint64_t chunk_pages = 0;
+            iotrace(process_begin, chunk.id, iotrace_tid());
+            clock_gettime(CLOCK_MONOTONIC, &kernel_start);
+            if (!order) {
+                // One kernel call over the share
+                chunk_first = share_first;
+                chunk_pages = share_pages;
+                if (chunk_pages > 0) {
+                    sum += visit_pages(kernel, chunk.start, chunk.size, chunk_first, chunk_pages, iterations, bytes);
+                    pages += chunk_pages;
+                }
+            } else {
+#ifndef NO_OMP
+#pragma omp for nowait
+#endif
+                for (i = 0; i < (int)count; i++) {
+                    uint64_t page = (*order)[i];
+                    sum += visit_page(kernel, chunk.start, chunk.size, page, iterations, latency, bytes);
+                    pages++;
+                    if (chunk_pages++ == 0) {
+                        chunk_first = page;
+                    }
+                }
+            }
+            clock_gettime(CLOCK_MONOTONIC, &kernel_end);
+            if (traffic && chunk_pages > 0) {
+                traffic->add(chunk.start + chunk_first * MY_PAGE_SIZE, chunk_pages * MY_PAGE_SIZE);
+            }
+            kernel_time += duration_ns(kernel_start, kernel_end);
+            iotrace(process_end, chunk.id, iotrace_tid());
+
+            // Everyone is done with the chunk before it gets replaced
+#ifndef NO_OMP
+#pragma omp barrier
+#endif
+        }
+        PAPI_read_counters(values, NUM_EVENTS);
+
+        thread_stats &t = stats[omp_get_thread_num()];
+        if (counters) {
+            CounterValues delta = counters->add(0, counters_begin);
+            t.dtlb_misses = delta.values[COUNTER_DTLB_MISSES];
+        }
+        t.active = true;
+        t.pages = pages;
+        t.bytes = bytes;
+        t.instructions = values[0];
+        t.sum = sum;
+        t.kernel_time = kernel_time;
+        t.steals = scheduler.steals(omp_get_thread_num());
+        if (vars->verbose && vars->format == FORMAT_TEXT) {
+            printf("Thread %d pages:%'d instr/page:%'lld total instr:%'lld\n", omp_get_thread_num(), pages, pages ? values[0]/pages : 0, values[0]);
+            printf("Thread %d sum:%'lu\n", omp_get_thread_num(), sum);
+            if (vars->schedule == SCHEDULE_STEAL) {
+                printf("Thread %d steals:%'lu\n", omp_get_thread_num(), t.steals);
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    // Bandwidth is over what the kernel went through
+    uint64_t accesses = 0;
+    off_t visited = 0;
+    for (const thread_stats &t : stats) {
+        accesses += t.pages;
+        visited += t.bytes;
+    }
+
+    if (vars->format == FORMAT_TEXT) {
+        printf("sum=%'lu\n", sum);
+        print_results(visited, time_diff(start, end));
+        print_iops(accesses, time_diff(start, end));
+        if (vars->cold) {
+            print_eviction(eviction);
+        }
+        printf("Backend: %s\n", backend_name(vars->backend));
+        printf("Page size: %zu, huge pages: %s\n", system_page_size(), vars->huge_pages ? "yes" : "no");
+        printf("Affinity: %s%s\n", affinity_name(vars->affinity), vars->membind ? ", membind" : "");
+        if (traffic) {
+            traffic->print(time_diff(start, end));
+        }
+        source->print_stats();
+        printf("Input stall (s): %f\n", source->stall_time());
+        print_kernel_results(vars->kernel, vars->isa, visited, (double)kernel_time / (double)NSECS_IN_SEC);
+        if (counters) {
+            counters->print();
+            // Compare with and without --huge-pages
+            if (accesses > 0 && counters->is_available(COUNTER_DTLB_MISSES)) {
+                CounterValues total = counters->stage_total(0);
+                printf("dTLB misses/page: %f\n", (double)total.values[COUNTER_DTLB_MISSES] / accesses);
+            }
+        }
+        if (latency) {
+            latency->print_text();
+        }
+        if (residency) {
+            residency->print_text();
+        }
+    } else {
+        Report report;
+        Report::Section &params = report.section("params");
+        params.set("program", progname);
+        params.set("filename", vars->filename);
+        params.set("iterations", vars->iterations);
+        params.set("threads", vars->threads);
+        params.set("chunk_size", (long)vars->chunk_size);
+        params.set("backend", backend_name(vars->backend));
+        params.set("queue_depth", vars->queue_depth);
+        params.set("schedule", vars->schedule == SCHEDULE_STEAL ? "steal" : "chunk");
+        params.set("grain", vars->grain);
+        params.set("kernel", kernel_name(vars->kernel));
+        params.set("isa", isa_name(vars->isa));
+        params.set("pattern", pattern_name(vars->pattern.pattern));
+        params.set("seed", (unsigned long)vars->pattern.seed);
+        params.set("stride", (unsigned long)vars->pattern.stride);
+        params.set("skew", vars->pattern.skew);
+        params.set("worst_case", vars->worst_case);
+        params.set("prefault", vars->prefault);
+        params.set("huge_pages", vars->huge_pages);
+        params.set("page_size", (unsigned long)system_page_size());
+        params.set("affinity", affinity_name(vars->affinity));
+        params.set("membind", vars->membind);
+        params.set("cold", vars->cold);
+
+        report_results(report, visited, time_diff(start, end));
+        report_iops(report, accesses, time_diff(start, end));
+        report.section("results").set("sum", (unsigned long)sum);
+        report.section("results").set("stall_s", source->stall_time());
+        source->report_stats(report);
+        if (vars->cold) {
+            report_eviction(report, eviction);
+        }
+        report_kernel_results(report, vars->kernel, vars->isa, visited, (double)kernel_time / (double)NSECS_IN_SEC);
+
+        for (size_t i = 0; i < stats.size(); i++) {
+            if (!stats[i].active) {
+                continue;
+            }
+            Report::Section &t = report.thread(i);
+            t.set("pages", stats[i].pages);
+            t.set("instructions", (long)stats[i].instructions);
+            t.set("sum", (unsigned long)stats[i].sum);
+            t.set("kernel_ns", (unsigned long)stats[i].kernel_time);
+            if (vars->schedule == SCHEDULE_STEAL) {
+                t.set("steals", (unsigned long)stats[i].steals);
+            }
+            if (counters && counters->is_available(COUNTER_DTLB_MISSES)) {
+                t.set("dtlb_misses", (unsigned long)stats[i].dtlb_misses);
+            }
+        }
+        // Threads are numbered by OpenMP here, so only the totals
+        // of the counters go in the report
+        if (counters) {
+            Report::Section &c = report.section("counters");
+            CounterValues total = counters->stage_total(0);
+            for (int i = 0; i < NUM_COUNTERS; i++) {
+                CounterEvent event = static_cast<CounterEvent>(i);
+                if (counters->is_available(event)) {
+                    c.set(counter_name(event), (unsigned long)total.values[i]);
+                }
+            }
+            if (accesses > 0 && counters->is_available(COUNTER_DTLB_MISSES)) {
+                c.set("dtlb-misses_per_page", (double)total.values[COUNTER_DTLB_MISSES] / accesses);
+            }
+        }
+        if (traffic) {
+            traffic->report(report, time_diff(start, end));
+        }
+        if (latency) {
+            latency->report(report);
+        }
+        if (residency) {
+            residency->report(report);
+        }
+        report.print(vars->format);
+    }
+    delete source;
+    delete residency;
+    delete counters;
+    delete latency;
+    delete vars;
+
+    tracepoint(tracekit, end);
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "steal.h"
+#include "util.h"
+
+StealingScheduler::StealingScheduler(ChunkSource &source, int nthreads, uint64_t grain, const PageOrders &orders)
+    : source(source), grain(grain), orders(orders) {
+    for (int i = 0; i < nthreads; i++) {
+        queues.emplace_back(new Queue());
+    }
+}
+
+bool StealingScheduler::pop(int thread, PageTask &task) {
+    Queue &q = *queues[thread];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.tasks.empty()) {
+        return false;
+    }
+    task = std::move(q.tasks.front());
+    q.tasks.pop_front();
+    return true;
+}
+
+bool StealingScheduler::steal(int thread, PageTask &task) {
+    int n = queues.size();
+    for (int i = 1; i < n; i++) {
+        Queue &victim = *queues[(thread + i) % n];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.tasks.empty()) {
+            continue;
+        }
+        // The owner works from the front, so the back is the
+        // furthest from what it is touching now
+        task = std::move(victim.tasks.back());
+        victim.tasks.pop_back();
+        queues[thread]->steals++;
+        return true;
+    }
+    return false;
+}
+
+bool StealingScheduler::refill(int thread) {
+    std::lock_guard<std::mutex> lock(source_mutex);
+    if (exhausted) {
+        return false;
+    }
+
+    Chunk chunk;
+    if (!source.next(chunk)) {
+        exhausted = true;
+        return false;
+    }
+
+    uint64_t count = (chunk.size + PAGE_SIZE - 1) / PAGE_SIZE;
+    PageOrder order = orders.of(chunk.offset);
+    if (order) {
+        count = order->size();
+    }
+
+    Queue &q = *queues[thread];
+    std::lock_guard<std::mutex> queue_lock(q.mutex);
+    for (uint64_t first = 0; first < count; first += grain) {
+        PageTask task;
+        task.chunk_id = chunk.id;
+        task.chunk_start = chunk.start;
+        task.chunk_size = chunk.size;
+        task.first = first;
+        task.count = count - first > grain ? grain : count - first;
+        task.order = order;
+        task.owner = chunk.owner;
+        q.tasks.push_back(std::move(task));
+    }
+    return true;
+}
+
+bool StealingScheduler::next(int thread, PageTask &task) {
+    while (true) {
+        if (pop(thread, task) || steal(thread, task)) {
+            return true;
+        }
+        if (!refill(thread)) {
+            // Tasks are only pushed by refill(), so once the source is
+            // exhausted a last look around settles it
+            return steal(thread, task);
+        }
+    }
+}
+
+uint64_t StealingScheduler::steals(int thread) const {
+    return queues[thread]->steals;
+}
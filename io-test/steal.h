@@ -0,0 +1,69 @@
+#ifndef IO_TEST_STEAL_H
+#define IO_TEST_STEAL_H
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "access_pattern.h"
+#include "chunk_source.h"
+
+// A range of the pages of a chunk, in the visiting order of the chunk.
+// The chunk stays mapped (or its buffer stays out of the pool) as long
+// as one of its tasks is alive.
+struct PageTask {
+    uint64_t chunk_id = 0;
+    uint8_t *chunk_start = NULL;
+    off_t chunk_size = 0;
+    // Positions in the order, in pages
+    uint64_t first = 0;
+    uint64_t count = 0;
+    // Page indices in visiting order, NULL for sequential
+    PageOrder order;
+    std::shared_ptr<void> owner;
+};
+
+// Splits the chunks of a source into tasks of a few pages, kept in one
+// deque per thread. A thread works from the front of its own deque and
+// steals from the back of the others once it runs dry; only when every
+// deque is empty does it read the next chunk from the source. Each chunk
+// is mapped once and shared by all the threads working on it, and
+// nobody waits for the others to finish a chunk.
+class StealingScheduler {
+public:
+    // grain is in pages
+    StealingScheduler(ChunkSource &source, int nthreads, uint64_t grain, const PageOrders &orders);
+
+    // Returns false once the source is exhausted and no task is left
+    bool next(int thread, PageTask &task);
+    // Tasks the thread took from another thread's deque
+    uint64_t steals(int thread) const;
+
+private:
+    struct Queue {
+        alignas(64) std::mutex mutex;
+        std::deque<PageTask> tasks;
+        uint64_t steals = 0;
+    };
+
+    bool pop(int thread, PageTask &task);
+    bool steal(int thread, PageTask &task);
+    // Splits the next chunk into the deque of thread. Returns false if
+    // the source is exhausted.
+    bool refill(int thread);
+
+    ChunkSource &source;
+    uint64_t grain;
+    const PageOrders &orders;
+    std::vector<std::unique_ptr<Queue> > queues;
+
+    // Serializes source->next(), which is not thread-safe
+    std::mutex source_mutex;
+    bool exhausted = false;
+};
+
+#endif // IO_TEST_STEAL_H
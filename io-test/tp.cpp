@@ -0,0 +1,5 @@
+// Instantiates the tracekit tracepoint provider, in this translation
+// unit only
+#define TRACEPOINT_DEFINE
+#define TRACEPOINT_CREATE_PROBES
+#include "tp.h"
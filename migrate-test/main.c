@@ -1,38 +1,475 @@
 #define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <pthread.h>
 #include <sched.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 
-void *worker(void *arg) {
-    FILE *fp = fopen("/dev/zero", "r");
-    size_t size = 1024*1024*sizeof(char);
-    char *buffer = malloc(size);
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
 
-    while (true) {
-        fread(buffer, size, 1, fp);
+#define PROGNAME "migrate-test"
+
+static const char *const progname = PROGNAME;
+
+static const int DEFAULT_PERIOD_US = 1000;
+static const int DEFAULT_DURATION = 5;
+static const size_t DEFAULT_BUFFER_SIZE = 1024 * 1024;
+// Read times kept for the median, later reads are only counted
+static const size_t MAX_SAMPLES = 1 << 20;
+
+static const uint64_t NSECS_IN_USEC = 1000;
+static const uint64_t NSECS_IN_SEC = 1000000000;
+static const double BYTES_IN_MBYTE = 1000000;
+
+enum Counter {
+    COUNTER_CACHE_MISSES,
+    COUNTER_L1D_MISSES,
+    COUNTER_MIGRATIONS,
+    NUM_COUNTERS,
+};
+
+static const char *const counter_names[NUM_COUNTERS] = {
+    "cache-misses",
+    "l1d-misses",
+    "cpu-migrations",
+};
+
+struct vars {
+    const char *filename;
+    int period_us;
+    int duration;
+    size_t size;
+    // CPUs the reader is moved between, in order
+    int cpus[CPU_SETSIZE];
+    int ncpus;
+    bool verbose;
+};
+
+// One run of the reader, pinned or migrating
+struct phase {
+    const struct vars *vars;
+    atomic_bool stop;
+
+    // Filled in by the reader
+    uint64_t elapsed_ns;
+    uint64_t bytes;
+    uint64_t reads;
+    // Times of reads that stayed on one CPU
+    uint64_t *samples;
+    size_t nsamples;
+    // Times of reads during which the reader changed CPU
+    uint64_t *stalls;
+    size_t nstalls;
+    uint64_t counters[NUM_COUNTERS];
+    bool available[NUM_COUNTERS];
+};
+
+__attribute__((noreturn))
+static void usage(void) {
+    fprintf(stderr, "Usage: %s [OPTIONS]\n", progname);
+    fprintf(stderr, "\nStreams a file (default /dev/zero) pinned to one CPU, then while being\n");
+    fprintf(stderr, "moved between CPUs, and compares the two runs.\n");
+    fprintf(stderr, "\nOptions:\n\n");
+    fprintf(stderr, "  --period, -p         set time between migrations, in microseconds\n");
+    fprintf(stderr, "  --duration, -d       set length of each run, in seconds\n");
+    fprintf(stderr, "  --cpus, -c           set CPUs to migrate between, as a list like 0,2,4-7\n");
+    fprintf(stderr, "                       (default: every CPU the process may run on)\n");
+    fprintf(stderr, "  --size, -s           set size of each read\n");
+    fprintf(stderr, "  --file, -f           set file to read, rewound at its end\n");
+    fprintf(stderr, "  --verbose, -v        set verbose output\n");
+    exit(EXIT_FAILURE);
+}
+
+// Parses a list like 0,2,4-7, keeping the CPUs that are also in allowed
+static bool parse_cpus(const char *list, const cpu_set_t *allowed, cpu_set_t *cpus) {
+    CPU_ZERO(cpus);
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p) {
+            return false;
+        }
+        p = end;
+        if (*p == '-') {
+            p++;
+            last = strtol(p, &end, 10);
+            if (end == p) {
+                return false;
+            }
+            p = end;
+        }
+        if (first < 0 || last >= CPU_SETSIZE || first > last) {
+            return false;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            if (CPU_ISSET(cpu, allowed)) {
+                CPU_SET(cpu, cpus);
+            }
+        }
+        if (*p == ',') {
+            p++;
+        } else if (*p) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void parse_opts(int argc, char **argv, struct vars *vars) {
+    int opt;
+    cpu_set_t allowed, cpus;
+
+    struct option options[] = {
+        { "help",   0, 0, 'h' },
+        { "verbose",   0, 0, 'v' },
+        { "period",   1, 0, 'p' },
+        { "duration",   1, 0, 'd' },
+        { "cpus",   1, 0, 'c' },
+        { "size",   1, 0, 's' },
+        { "file",   1, 0, 'f' },
+        { 0, 0, 0, 0 },
+    };
+    int idx;
+
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+        perror("sched_getaffinity");
+        exit(EXIT_FAILURE);
+    }
+    cpus = allowed;
+
+    while ((opt = getopt_long(argc, argv, "hvp:d:c:s:f:", options, &idx)) != -1) {
+        switch (opt) {
+            case 'p':
+                vars->period_us = atoi(optarg);
+                break;
+            case 'd':
+                vars->duration = atoi(optarg);
+                break;
+            case 'c':
+                if (!parse_cpus(optarg, &allowed, &cpus)) {
+                    fprintf(stderr, "Invalid CPU list: %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 's':
+                vars->size = atol(optarg);
+                break;
+            case 'f':
+                vars->filename = optarg;
+                break;
+            case 'v':
+                vars->verbose = true;
+                break;
+            case 'h':
+                usage();
+                break;
+            default:
+                usage();
+                break;
+        }
     }
 
+    // Default values
+    if (vars->filename == NULL) {
+        vars->filename = "/dev/zero";
+    }
+    if (vars->period_us <= 0) {
+        vars->period_us = DEFAULT_PERIOD_US;
+        if (vars->verbose) {
+            printf("using default period: %d us\n", vars->period_us);
+        }
+    }
+    if (vars->duration <= 0) {
+        vars->duration = DEFAULT_DURATION;
+        if (vars->verbose) {
+            printf("using default duration: %d s\n", vars->duration);
+        }
+    }
+    if (vars->size == 0) {
+        vars->size = DEFAULT_BUFFER_SIZE;
+        if (vars->verbose) {
+            printf("using default read size: %zu\n", vars->size);
+        }
+    }
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &cpus)) {
+            vars->cpus[vars->ncpus++] = cpu;
+        }
+    }
+    if (vars->ncpus == 0) {
+        fprintf(stderr, "No usable CPU in the list.\n");
+        usage();
+    }
+}
+
+static uint64_t now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * NSECS_IN_SEC + t.tv_nsec;
+}
+
+static void pin(pthread_t thread, int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int ret = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_setaffinity_np: %s\n", strerror(ret));
+    }
+}
+
+// Counts for the calling thread only, -1 if not supported here. The
+// copy out of the file happens in the kernel, so kernel mode is counted
+// too unless perf_event_paranoid forbids it.
+static int open_counter(enum Counter counter) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.disabled = 1;
+    attr.exclude_hv = 1;
+    switch (counter) {
+        case COUNTER_CACHE_MISSES:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        case COUNTER_L1D_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        default:
+            attr.type = PERF_TYPE_SOFTWARE;
+            attr.config = PERF_COUNT_SW_CPU_MIGRATIONS;
+            break;
+    }
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd == -1) {
+        attr.exclude_kernel = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    return fd;
+}
+
+static void *reader(void *arg) {
+    struct phase *p = arg;
+    const struct vars *vars = p->vars;
+
+    // Both runs start on the first CPU
+    pin(pthread_self(), vars->cpus[0]);
+
+    int fd = open(vars->filename, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Error: cannot open file %s: %s\n", vars->filename, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    char *buffer = malloc(vars->size);
+    p->samples = malloc(MAX_SAMPLES * sizeof(uint64_t));
+    p->stalls = malloc(MAX_SAMPLES * sizeof(uint64_t));
+    if (buffer == NULL || p->samples == NULL || p->stalls == NULL) {
+        fprintf(stderr, "Error: cannot allocate buffers.\n");
+        exit(EXIT_FAILURE);
+    }
+    // Fault the buffer in before measuring
+    memset(buffer, 0, vars->size);
+
+    int fds[NUM_COUNTERS];
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        fds[i] = open_counter(i);
+        p->available[i] = fds[i] != -1;
+        if (fds[i] != -1) {
+            ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    uint64_t start = now_ns();
+    int last_cpu = sched_getcpu();
+    while (!atomic_load_explicit(&p->stop, memory_order_relaxed)) {
+        uint64_t t0 = now_ns();
+        ssize_t n = read(fd, buffer, vars->size);
+        uint64_t t1 = now_ns();
+        if (n == 0) {
+            lseek(fd, 0, SEEK_SET);
+            continue;
+        } else if (n < 0) {
+            perror("read");
+            break;
+        }
+        p->bytes += n;
+        p->reads++;
+
+        // A read that started on another CPU took the migration
+        int cpu = sched_getcpu();
+        if (cpu != last_cpu) {
+            if (p->nstalls < MAX_SAMPLES) {
+                p->stalls[p->nstalls++] = t1 - t0;
+            }
+            last_cpu = cpu;
+        } else if (p->nsamples < MAX_SAMPLES) {
+            p->samples[p->nsamples++] = t1 - t0;
+        }
+    }
+    p->elapsed_ns = now_ns() - start;
+
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        if (fds[i] == -1) {
+            continue;
+        }
+        ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fds[i], &p->counters[i], sizeof(uint64_t)) != sizeof(uint64_t)) {
+            p->available[i] = false;
+        }
+        close(fds[i]);
+    }
     free(buffer);
+    close(fd);
     return NULL;
 }
 
-int main(int argc, char **argv) {
-    cpu_set_t cpuset;
+// Runs the reader for the whole duration, moving it to the next CPU of
+// the list every period if migrate is set. Returns migrations requested.
+static uint64_t run_phase(const struct vars *vars, struct phase *p, bool migrate) {
     pthread_t thread;
+    struct timespec period = {
+        .tv_sec = vars->period_us / 1000000,
+        .tv_nsec = (vars->period_us % 1000000) * NSECS_IN_USEC,
+    };
+    uint64_t requested = 0;
+
+    memset(p, 0, sizeof(*p));
+    p->vars = vars;
+    atomic_init(&p->stop, false);
 
-    pthread_create(&thread, NULL, worker, NULL);
+    pthread_create(&thread, NULL, reader, p);
 
-    const int numCpus = 8;
+    uint64_t end = now_ns() + (uint64_t)vars->duration * NSECS_IN_SEC;
     int i = 0;
-    struct timespec timeout = { .tv_sec = 0, .tv_nsec = 1000000 };
-    while (true) {
-        CPU_ZERO(&cpuset);
-        CPU_SET(i, &cpuset);
-        i = (i + 1) % numCpus;
-        pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset);
-        nanosleep(&timeout, NULL);
+    while (now_ns() < end) {
+        if (!migrate) {
+            struct timespec rest = { .tv_sec = 0, .tv_nsec = 100 * 1000000 };
+            nanosleep(&rest, NULL);
+            continue;
+        }
+        nanosleep(&period, NULL);
+        i = (i + 1) % vars->ncpus;
+        pin(thread, vars->cpus[i]);
+        requested++;
+    }
+    atomic_store(&p->stop, true);
+    pthread_join(thread, NULL);
+    return requested;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Sorts values in place
+static uint64_t percentile(uint64_t *values, size_t n, double pct) {
+    if (n == 0) {
+        return 0;
+    }
+    qsort(values, n, sizeof(uint64_t), compare_u64);
+    size_t i = (size_t)(pct / 100.0 * (n - 1) + 0.5);
+    return values[i];
+}
+
+static double bandwidth(const struct phase *p) {
+    return ((double)p->bytes / ((double)p->elapsed_ns / NSECS_IN_SEC)) / BYTES_IN_MBYTE;
+}
+
+static void print_phase(const char *name, const struct phase *p) {
+    printf("%s bandwidth (MB/s): %f\n", name, bandwidth(p));
+    printf("%s reads: %lu, median read (us): %.1f\n", name, p->reads,
+            (double)percentile(p->samples, p->nsamples, 50) / NSECS_IN_USEC);
+    printf("%s counters:", name);
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        if (p->available[i]) {
+            printf(" %s:%lu", counter_names[i], p->counters[i]);
+        } else {
+            printf(" %s:n/a", counter_names[i]);
+        }
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    struct vars vars;
+    struct phase pinned, migrating;
+
+    memset(&vars, 0, sizeof(vars));
+    parse_opts(argc, argv, &vars);
+
+    printf("CPUs:");
+    for (int i = 0; i < vars.ncpus; i++) {
+        printf("%s%d", i ? "," : " ", vars.cpus[i]);
+    }
+    printf("\n");
+    printf("Migration period (us): %d\n", vars.period_us);
+    if (vars.ncpus < 2) {
+        fprintf(stderr, "Warning: only one CPU, the reader cannot migrate\n");
     }
+
+    run_phase(&vars, &pinned, false);
+    uint64_t requested = run_phase(&vars, &migrating, true);
+
+    print_phase("Pinned", &pinned);
+    print_phase("Migrating", &migrating);
+
+    double pinned_mbps = bandwidth(&pinned);
+    if (pinned_mbps > 0) {
+        printf("Bandwidth change: %+.2f%%\n", 100.0 * (bandwidth(&migrating) - pinned_mbps) / pinned_mbps);
+    }
+
+    // Stall of a migration: time a read that moved took over a read
+    // of the pinned run
+    uint64_t base = percentile(pinned.samples, pinned.nsamples, 50);
+    for (size_t i = 0; i < migrating.nstalls; i++) {
+        migrating.stalls[i] = migrating.stalls[i] > base ? migrating.stalls[i] - base : 0;
+    }
+    double mean = 0;
+    for (size_t i = 0; i < migrating.nstalls; i++) {
+        mean += migrating.stalls[i];
+    }
+    if (migrating.nstalls > 0) {
+        mean /= migrating.nstalls;
+    }
+    printf("Migrations requested: %lu, seen by the reader: %zu\n", requested, migrating.nstalls);
+    printf("Migration stall (us): mean %.1f p50 %.1f p99 %.1f max %.1f\n",
+            mean / NSECS_IN_USEC,
+            (double)percentile(migrating.stalls, migrating.nstalls, 50) / NSECS_IN_USEC,
+            (double)percentile(migrating.stalls, migrating.nstalls, 99) / NSECS_IN_USEC,
+            (double)percentile(migrating.stalls, migrating.nstalls, 100) / NSECS_IN_USEC);
+
+    // Per MB read, since both runs read different amounts
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        if (!pinned.available[i] || !migrating.available[i] || pinned.bytes == 0 || migrating.bytes == 0) {
+            continue;
+        }
+        double before = pinned.counters[i] / (pinned.bytes / BYTES_IN_MBYTE);
+        double after = migrating.counters[i] / (migrating.bytes / BYTES_IN_MBYTE);
+        printf("Delta %s/MB: %+f (%f pinned, %f migrating)\n", counter_names[i], after - before, before, after);
+    }
+
+    free(pinned.samples);
+    free(pinned.stalls);
+    free(migrating.samples);
+    free(migrating.stalls);
+    return 0;
 }
@@ -2,53 +2,92 @@
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
 
-#include <fcntl.h>
-#include <unistd.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
 #include <time.h>
 
-#include <tbb/tbb.h>
 #include <getopt.h>
 
+#include "access_pattern.h"
+#include "affinity.h"
+#include "chunk_source.h"
+#include "histogram.h"
+#include "kernels.h"
+#include "page_cache.h"
+#include "per_thread.h"
+#include "perf_counters.h"
+#include "pipeline.h"
+#include "report.h"
+#include "residency.h"
+#include "util.h"
+
 #define PROGNAME "pipelined-io-test"
 
 static const char *const progname = PROGNAME;
 
-static const int PAGE_SIZE = 4096;
-
-static const int BYTES_IN_MBYTE = 1000000;
-static const int NSECS_IN_MSEC = 1000000;
-static const int NSECS_IN_SEC = 1000000000;
-
 static const int DEFAULT_ITERATIONS = 10000;
 static const int DEFAULT_THREADS = 1;
 static const int DEFAULT_META_CHUNK_SIZE = 2048 * PAGE_SIZE;
+static const int DEFAULT_PREFETCH = 1;
+static const int DEFAULT_QUEUE_DEPTH = 8;
 //static const int DEFAULT_CHUNK_SIZE = 32 * PAGE_SIZE;
 static const int DEFAULT_CHUNK_SIZE = DEFAULT_META_CHUNK_SIZE;
 
-struct Vars {
-    std::string filename;
-    int iterations = 0;
-    int threads = 0;
-    int ntokens = 0;
-    off_t meta_chunk_size = 0;
-    off_t chunk_size = 0;
+struct Vars : PipelineConfig {
+    Vars() {
+        prefetch = -1;
+        open_files = 0;
+    }
+
+    // As given on the command line, before expanding directories
+    std::vector<std::string> inputs;
+    // Readers running at once over the same files
+    int instances = 1;
     bool verbose = false;
-    bool prefault = false;
+    bool cold = false;
+    bool counters = false;
+    bool residency = false;
+    bool latency = false;
+    OutputFormat format = FORMAT_TEXT;
 };
 
 __attribute__((noreturn))
 static void usage(void) {
-    fprintf(stderr, "Usage: %s [OPTIONS] file\n", progname);
+    fprintf(stderr, "Usage: %s [OPTIONS] file|directory...\n", progname);
+    fprintf(stderr, "\nDirectories are read as all the regular files they contain.\n");
     fprintf(stderr, "\nOptions:\n\n");
     fprintf(stderr, "  --iterations, -i         set number of iterations per page\n");
     fprintf(stderr, "  --meta-chunk-size, -m    set size of metachunks\n");
     fprintf(stderr, "  --chunk-size, -c         set size of chunks\n");
     fprintf(stderr, "  --threads, -t            set number of threads\n");
     fprintf(stderr, "  --ntokens, -n            set number of tokens in pipeline\n");
+    fprintf(stderr, "  --window, -w             set maximum number of mapped metachunks\n");
+    fprintf(stderr, "  --prefetch, -f           set number of metachunks mapped ahead (0 to disable)\n");
+    fprintf(stderr, "  --files, -F              read many files interleaved (default) in one pipeline,\n");
+    fprintf(stderr, "                           or in parallel with one pipeline each\n");
+    fprintf(stderr, "  --open-files, -O         set number of files read at once in parallel (default: threads)\n");
+    fprintf(stderr, "  --instances, -I          run that many pipelines at once over the files\n");
+    fprintf(stderr, "  --backend, -b            read with mmap (default), pread, direct, splice or uring\n");
+    fprintf(stderr, "  --queue-depth, -q        set number of reads in flight with uring\n");
+    fprintf(stderr, "  --pattern, -a            visit pages of chunks in sequential (default), random, strided or zipfian order\n");
+    fprintf(stderr, "  --seed, -e               set seed of the access pattern\n");
+    fprintf(stderr, "  --stride, -y             set stride of the strided pattern, in pages\n");
+    fprintf(stderr, "  --skew, -z               set exponent of the zipfian pattern\n");
+    fprintf(stderr, "  --kernel, -k             set work done on chunks: touch (default), crc32c, histogram or scan\n");
+    fprintf(stderr, "  --isa, -x                limit kernel to scalar, sse2, sse4.2, avx2 or avx512\n");
+    fprintf(stderr, "  --affinity, -A           pin threads: none (default), compact, scatter or numa\n");
+    fprintf(stderr, "  --membind, -M            fault chunks in from their worker, on its node (implies numa)\n");
+    fprintf(stderr, "  --counters, -C           collect hardware counters per thread and stage\n");
+    fprintf(stderr, "  --latency, -l            record per-stage latency histograms\n");
+    fprintf(stderr, "  --residency-report, -r   sample page cache residency of each metachunk (mmap only)\n");
+    fprintf(stderr, "  --cold, -d               evict the file from the page cache first (no root needed)\n");
+    fprintf(stderr, "  --format, -o             print results as text (default), json or csv\n");
     fprintf(stderr, "  --prefault, -p           prefault pages when reading file\n");
+    fprintf(stderr, "  --huge-pages, -H         map on huge page boundaries with transparent huge pages,\n");
+    fprintf(stderr, "                           or use huge page read buffers with other backends\n");
     fprintf(stderr, "  --verbose, -v            set verbose output\n");
     exit(EXIT_FAILURE);
 }
@@ -61,16 +100,37 @@ static void parse_opts(int argc, char **argv, Vars &vars) {
         { "help",   0, 0, 'h' },
         { "verbose",   0, 0, 'v' },
         { "prefault",   0, 0, 'p' },
+        { "huge-pages",   0, 0, 'H' },
+        { "cold",   0, 0, 'd' },
+        { "counters",   0, 0, 'C' },
+        { "membind",   0, 0, 'M' },
+        { "affinity",   1, 0, 'A' },
+        { "residency-report",   0, 0, 'r' },
+        { "latency",   0, 0, 'l' },
         { "iterations",   1, 0, 'i' },
         { "meta-chunk-size",   1, 0, 'm' },
         { "chunk-size",   1, 0, 'c' },
         { "threads",   1, 0, 't' },
         { "ntokens",   1, 0, 'n' },
+        { "window",   1, 0, 'w' },
+        { "prefetch",   1, 0, 'f' },
+        { "files",   1, 0, 'F' },
+        { "open-files",   1, 0, 'O' },
+        { "instances",   1, 0, 'I' },
+        { "backend",   1, 0, 'b' },
+        { "queue-depth",   1, 0, 'q' },
+        { "pattern",   1, 0, 'a' },
+        { "seed",   1, 0, 'e' },
+        { "stride",   1, 0, 'y' },
+        { "skew",   1, 0, 'z' },
+        { "kernel",   1, 0, 'k' },
+        { "isa",   1, 0, 'x' },
+        { "format",   1, 0, 'o' },
         { 0, 0, 0, 0 },
     };
     int idx;
 
-    while ((opt = getopt_long(argc, argv, "hvpi:n:t:m:c:", options, &idx)) != -1) {
+    while ((opt = getopt_long(argc, argv, "hvpHdrlCMA:F:O:I:i:n:t:m:c:w:f:b:q:a:e:y:z:k:x:o:", options, &idx)) != -1) {
         switch (opt) {
             case 'i':
                 vars.iterations = atoi(optarg);
@@ -81,6 +141,52 @@ static void parse_opts(int argc, char **argv, Vars &vars) {
             case 'n':
                 vars.ntokens = atoi(optarg);
                 break;
+            case 'w':
+                vars.window = atoi(optarg);
+                break;
+            case 'f':
+                vars.prefetch = atoi(optarg);
+                break;
+            case 'b':
+                if (!parse_backend(optarg, vars.backend)) {
+                    fprintf(stderr, "Unknown backend: %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'q':
+                vars.queue_depth = atoi(optarg);
+                break;
+            case 'a':
+                if (!parse_pattern(optarg, vars.pattern.pattern)) {
+                    fprintf(stderr, "Unknown access pattern: %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'e':
+                vars.pattern.seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'y':
+                vars.pattern.stride = atol(optarg);
+                break;
+            case 'z':
+                vars.pattern.skew = atof(optarg);
+                if (!(vars.pattern.skew > 0)) {
+                    fprintf(stderr, "Invalid skew: %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'k':
+                if (!parse_kernel(optarg, vars.kernel)) {
+                    fprintf(stderr, "Unknown kernel: %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'x':
+                if (!parse_isa(optarg, vars.isa)) {
+                    fprintf(stderr, "Unknown instruction set: %s\n", optarg);
+                    usage();
+                }
+                break;
             case 'c':
                 vars.chunk_size = atoi(optarg);
                 break;
@@ -93,6 +199,56 @@ static void parse_opts(int argc, char **argv, Vars &vars) {
             case 'p':
                 vars.prefault = true;
                 break;
+            case 'H':
+                vars.huge_pages = true;
+                break;
+            case 'd':
+                vars.cold = true;
+                break;
+            case 'C':
+                vars.counters = true;
+                break;
+            case 'r':
+                vars.residency = true;
+                break;
+            case 'l':
+                vars.latency = true;
+                break;
+            case 'A':
+                if (!parse_affinity(optarg, vars.affinity)) {
+                    fprintf(stderr, "Unknown affinity: %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'M':
+                vars.membind = true;
+                break;
+            case 'I':
+                vars.instances = atoi(optarg);
+                if (vars.instances < 1) {
+                    fprintf(stderr, "Invalid number of instances: %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'O':
+                vars.open_files = atoi(optarg);
+                if (vars.open_files < 1) {
+                    fprintf(stderr, "Invalid number of open files: %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'F':
+                if (!parse_file_schedule(optarg, vars.file_schedule)) {
+                    fprintf(stderr, "Unknown file schedule: %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'o':
+                if (!parse_format(optarg, vars.format)) {
+                    fprintf(stderr, "Unknown output format: %s\n", optarg);
+                    usage();
+                }
+                break;
             case 'h':
                 usage();
                 break;
@@ -102,12 +258,16 @@ static void parse_opts(int argc, char **argv, Vars &vars) {
         }
     }
 
-    // Non-option arg for filename
+    // Non-option args for files and directories
     if (optind >= argc) {
         fprintf(stderr, "File name missing.\n");
         usage();
-    } else {
-        vars.filename = argv[optind];
+    }
+    vars.inputs.assign(argv + optind, argv + argc);
+    vars.files = expand_inputs(vars.inputs);
+    if (vars.files.empty()) {
+        fprintf(stderr, "No file to read.\n");
+        usage();
     }
 
     // Default values
@@ -132,208 +292,299 @@ static void parse_opts(int argc, char **argv, Vars &vars) {
         }
     }
 
-    if (vars.chunk_size == 0) {
-        vars.chunk_size = DEFAULT_CHUNK_SIZE;
+    if (vars.open_files == 0) {
+        // One pipeline per thread keeps them all busy
+        vars.open_files = vars.threads;
         if (vars.verbose) {
-            printf("using default chunk size: %ld\n", vars.chunk_size);
+            printf("using default open files: %d\n", vars.open_files);
         }
     }
 
-    if (vars.meta_chunk_size == 0) {
-        vars.meta_chunk_size = DEFAULT_META_CHUNK_SIZE;
+    if (vars.prefetch < 0) {
+        vars.prefetch = DEFAULT_PREFETCH;
         if (vars.verbose) {
-            printf("using default meta chunk size: %ld\n", vars.meta_chunk_size);
+            printf("using default prefetch: %d\n", vars.prefetch);
         }
     }
-}
-
-struct MetaChunk {
-    uint8_t *start = NULL;
-    off_t size = 0;
-    off_t offset = 0;
-    off_t processed = 0;
-};
-
-MetaChunk metachunk;
-
-// One chunk will be at most 32 pages
-struct Chunk {
-    uint8_t *start = NULL;
-    off_t size = 0;
-    uint64_t result = 0;
-};
-
-class InputFunctor {
-    public:
-        InputFunctor(int fd, off_t filesize, const Vars &vars);
-        InputFunctor(const InputFunctor &other);
-        ~InputFunctor();
-        Chunk operator()(tbb::flow_control &fc) const;
-    private:
-        int fd;
-        off_t filesize;
-        const Vars &vars;
-};
-
-InputFunctor::InputFunctor(int fd, off_t filesize, const Vars &vars) 
-    : fd(fd), filesize(filesize), vars(vars) {
-}
-
-InputFunctor::InputFunctor(const InputFunctor &other) : fd(other.fd), filesize(other.filesize), vars(other.vars) {
-}
-
-InputFunctor::~InputFunctor() {
-}
 
-Chunk InputFunctor::operator()(tbb::flow_control &fc) const {
-    // Ending condition : we have read the last chunk of 
-    // the last metachunk
-    if (metachunk.offset >= filesize && metachunk.processed >= metachunk.size) {
-        fc.stop();
-        return Chunk();
-    }
-
-    // Check if we need to mmap a new metachunk
-    // Happens if no metachunk is mmap'd and
-    // when we have processed all the chunks
-    if (metachunk.start == NULL || metachunk.processed >= metachunk.size) {
-        // Unmap old one, if necessary
-        if (metachunk.start != NULL) {
-            // TODO: No unmapping at the moment
-            //munmap(metachunk.start, metachunk.size);
-        }
-        off_t remaining = filesize - metachunk.offset;
-        metachunk.size = remaining > vars.meta_chunk_size ? vars.meta_chunk_size : remaining;
-        int flags = MAP_PRIVATE;
-        if (vars.prefault) flags |= MAP_POPULATE;
-        metachunk.start = static_cast<uint8_t*>(mmap(NULL, metachunk.size, PROT_READ, flags, fd, metachunk.offset));
-        if (metachunk.start == MAP_FAILED) {
-            perror("mmap");
-            exit(EXIT_FAILURE);
+    if (vars.window == 0) {
+        // Every token in flight can pin a distinct metachunk, plus the
+        // one the input filter is currently splitting and the ones
+        // mapped ahead by the prefetcher
+        vars.window = vars.ntokens + 1 + vars.prefetch;
+        if (vars.verbose) {
+            printf("using default window: %d\n", vars.window);
         }
-        metachunk.offset += metachunk.size;
-        metachunk.processed = 0;
-        madvise(metachunk.start, metachunk.size, MADV_SEQUENTIAL);
     }
 
-    // Dispatch the next chunk
-    Chunk c;
-    off_t remaining = metachunk.size - metachunk.processed;
-    c.start = metachunk.start + metachunk.processed;
-    c.size = remaining > vars.chunk_size ? vars.chunk_size : remaining;
-    metachunk.processed += c.size;
-
-    return c;
-}
-
-class ProcessFunctor {
-public:
-    ProcessFunctor(const Vars &vars);
-    ProcessFunctor(const ProcessFunctor &other);
-    Chunk operator()(Chunk input) const;
-
-private:
-    const Vars &vars;
-};
-
-ProcessFunctor::ProcessFunctor(const Vars &vars) : vars(vars) {
-}
-
-ProcessFunctor::ProcessFunctor(const ProcessFunctor &other) : vars(other.vars) {
-}
+    if (vars.pattern.pattern != PATTERN_SEQUENTIAL) {
+        // Per-page latency is the point of a pattern
+        vars.latency = true;
+    }
 
-Chunk ProcessFunctor::operator()(Chunk input) const {
-    uint64_t sum = 0;
-    for (int i = 0; i < input.size; i += PAGE_SIZE) {
-        sum += input.start[i];
-        for (int j = 0; j < vars.iterations; j++) {
-            sum++;
-            asm("");
+    if (vars.membind && vars.affinity == AFFINITY_NONE) {
+        vars.affinity = AFFINITY_NUMA;
+        if (vars.verbose) {
+            printf("using membind affinity: %s\n", affinity_name(vars.affinity));
         }
     }
-    input.result = sum;
-    return input;
-}
-
-uint64_t global_sum = 0;
-
-class OutputFunctor {
-public:
-    void operator()(Chunk input) const;
-};
-
-void OutputFunctor::operator()(Chunk input) const {
-    global_sum += input.result;
-    munmap(input.start, input.size);
-}
 
-off_t get_filesize(int fd) {
-    struct stat stats;
-    int ret = -1;
-    if (fstat(fd, &stats) == 0) {
-        ret = stats.st_size;
+    if (vars.queue_depth == 0) {
+        vars.queue_depth = DEFAULT_QUEUE_DEPTH;
+        if (vars.verbose) {
+            printf("using default queue depth: %d\n", vars.queue_depth);
+        }
     }
 
-    return ret;
-}
+    if (vars.chunk_size == 0) {
+        vars.chunk_size = DEFAULT_CHUNK_SIZE;
+        if (vars.verbose) {
+            printf("using default chunk size: %ld\n", vars.chunk_size);
+        }
+    }
 
-struct timespec time_diff(struct timespec start,struct timespec end) {
-    struct timespec ret;
-    if ((end.tv_nsec - start.tv_nsec) < 0) {
-        ret.tv_sec = end.tv_sec - start.tv_sec - 1;
-        ret.tv_nsec = NSECS_IN_SEC + end.tv_nsec - start.tv_nsec;
-    } else {
-        ret.tv_sec = end.tv_sec - start.tv_sec;
-        ret.tv_nsec = end.tv_nsec - start.tv_nsec;
+    if (vars.meta_chunk_size == 0) {
+        vars.meta_chunk_size = DEFAULT_META_CHUNK_SIZE;
+        if (vars.verbose) {
+            printf("using default meta chunk size: %ld\n", vars.meta_chunk_size);
+        }
     }
-    return ret;
 }
 
 int main(int argc, char **argv) {
     Vars vars;
     parse_opts(argc, argv, vars);
 
-    int fd = open(vars.filename.c_str(), O_RDONLY);
-    if (fd == -1) {
-        std::cerr << "Error: cannot open file " << vars.filename << std::endl;
-        exit(EXIT_FAILURE);
+    if (vars.chunk_size % system_page_size() != 0) {
+        vars.chunk_size = round_up(vars.chunk_size, system_page_size());
+        printf("Growing chunk size to nearest page multiple: %'jd\n", vars.chunk_size);
     }
 
-    off_t filesize = get_filesize(fd);
-    if (filesize == -1) {
-        std::cerr << "Error: cannot get file size." << std::endl;
-        exit(EXIT_FAILURE);
+    // Huge pages can only back metachunks that start on a huge page
+    // boundary of the file
+    off_t meta_align = system_page_size();
+    if (vars.huge_pages && vars.backend == BACKEND_MMAP) {
+        meta_align = huge_page_size();
+    }
+    if (vars.meta_chunk_size % meta_align != 0) {
+        vars.meta_chunk_size = round_up(vars.meta_chunk_size, meta_align);
+        printf("Growing meta chunk size to nearest %spage multiple: %'jd\n",
+                meta_align > (off_t)system_page_size() ? "huge " : "", vars.meta_chunk_size);
     }
 
-    if (vars.chunk_size % PAGE_SIZE != 0) {
-        vars.chunk_size += (PAGE_SIZE - (vars.chunk_size % PAGE_SIZE));
-        printf("Growing chunk size to nearest page multiple: %'jd\n", vars.chunk_size);
+    PerThread<WorkerStats> workers;
+    PipelineProbes probes;
+    probes.workers = &workers;
+
+    // Only worth its per-chunk lookups when threads are placed
+    std::unique_ptr<NodeTraffic> traffic;
+    if (vars.affinity != AFFINITY_NONE) {
+        traffic.reset(new NodeTraffic());
+        probes.traffic = traffic.get();
     }
 
-    if (vars.meta_chunk_size % PAGE_SIZE != 0) {
-        vars.meta_chunk_size += (PAGE_SIZE - (vars.meta_chunk_size % PAGE_SIZE));
-        printf("Growing meta chunk size to nearest page multiple: %'jd\n", vars.chunk_size);
+    std::unique_ptr<PerfCounters> counters;
+    if (vars.counters) {
+        counters.reset(new PerfCounters(pipeline_stages));
+        probes.counters = counters.get();
     }
 
-    tbb::task_scheduler_init init(vars.threads);
+    std::unique_ptr<StageHistograms> latency;
+    if (vars.latency) {
+        latency.reset(new StageHistograms(pipeline_latency_stages));
+        probes.latency = latency.get();
+    }
 
-    tbb::filter_t<void, Chunk> in(tbb::filter::serial_in_order, InputFunctor(fd, filesize, vars));
-    tbb::filter_t<Chunk, Chunk> process(tbb::filter::parallel, ProcessFunctor(vars));
-    tbb::filter_t<Chunk, void> out(tbb::filter::serial_out_of_order, OutputFunctor());
-    tbb::filter_t<void,void> merge = in & process & out;
+    Eviction eviction;
+    if (vars.cold) {
+        eviction = evict_files(vars.files);
+    }
+
+    std::unique_ptr<ResidencyTracker> residency;
+    if (vars.residency) {
+        if (vars.backend != BACKEND_MMAP) {
+            fprintf(stderr, "Residency report only covers the mmap backend\n");
+        }
+        residency.reset(new ResidencyTracker());
+        probes.residency = residency.get();
+    }
 
+    // Concurrent readers share their workers, so they share the pinning
+    std::unique_ptr<WorkerPinning> pinning;
+    PipelineConfig config = vars;
+    if (vars.instances > 1 && vars.affinity != AFFINITY_NONE) {
+        pinning.reset(new WorkerPinning(vars.affinity, vars.membind));
+        config.affinity = AFFINITY_NONE;
+    }
+    std::vector<std::unique_ptr<PipelinedReader> > readers;
+    for (int i = 0; i < vars.instances; i++) {
+        readers.emplace_back(new PipelinedReader(config, probes));
+        readers.back()->open();
+    }
+    std::vector<PipelineResult> instances;
     timespec start, end;
     clock_gettime(CLOCK_MONOTONIC, &start);
+    if (vars.instances == 1) {
+        instances.push_back(readers[0]->run());
+    } else {
+        instances = run_concurrently(readers);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
 
-    tbb::parallel_pipeline(vars.ntokens, merge);
+    // Results add up over all the instances, into the first one. Each
+    // instance has its own sources, only the report's "source" section
+    // comes from the first.
+    PipelineResult &result = instances[0];
+    ChunkSource *source = result.source.get();
+    // Bandwidth is over the bytes visited, as in io-test
+    off_t bytes = result.visited;
+    double stall = source->stall_time();
+    for (size_t i = 1; i < instances.size(); i++) {
+        result.sum += instances[i].sum;
+        result.kernel_time += instances[i].kernel_time;
+        result.accesses += instances[i].accesses;
+        bytes += instances[i].visited;
+        stall += instances[i].source->stall_time();
+    }
+    if (vars.instances > 1) {
+        result.elapsed = time_diff(start, end);
+    }
 
-    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (vars.format != FORMAT_TEXT) {
+        Report report;
+        Report::Section &params = report.section("params");
+        params.set("program", progname);
+        std::string inputs;
+        for (const std::string &input : vars.inputs) {
+            inputs += (inputs.empty() ? "" : " ") + input;
+        }
+        params.set("filename", inputs);
+        params.set("files", (int)vars.files.size());
+        params.set("file_schedule", file_schedule_name(vars.file_schedule));
+        params.set("open_files", vars.open_files);
+        params.set("instances", vars.instances);
+        params.set("iterations", vars.iterations);
+        params.set("threads", vars.threads);
+        params.set("ntokens", vars.ntokens);
+        params.set("meta_chunk_size", (long)vars.meta_chunk_size);
+        params.set("chunk_size", (long)vars.chunk_size);
+        params.set("window", vars.window);
+        params.set("prefetch", vars.prefetch);
+        params.set("backend", backend_name(vars.backend));
+        params.set("queue_depth", vars.queue_depth);
+        params.set("kernel", kernel_name(vars.kernel));
+        params.set("isa", isa_name(result.isa));
+        params.set("pattern", pattern_name(vars.pattern.pattern));
+        params.set("seed", (unsigned long)vars.pattern.seed);
+        params.set("stride", (unsigned long)vars.pattern.stride);
+        params.set("skew", vars.pattern.skew);
+        params.set("prefault", vars.prefault);
+        params.set("huge_pages", vars.huge_pages);
+        params.set("page_size", (unsigned long)system_page_size());
+        params.set("affinity", affinity_name(vars.affinity));
+        params.set("membind", vars.membind);
+        params.set("cold", vars.cold);
+
+        report_results(report, bytes, result.elapsed);
+        report_iops(report, result.accesses, result.elapsed);
+        report.section("results").set("sum", (unsigned long)result.sum);
+        report.section("results").set("stall_s", stall);
+        source->report_stats(report);
+        if (vars.cold) {
+            report_eviction(report, eviction);
+        }
+        report_kernel_results(report, vars.kernel, result.isa, bytes,
+                (double)result.kernel_time / (double)NSECS_IN_SEC);
+
+        for (const WorkerStats *w : workers.all()) {
+            Report::Section &t = report.worker(w->tid);
+            t.set("chunks", (unsigned long)w->chunks);
+            t.set("bytes", (unsigned long)w->bytes);
+            t.set("kernel_ns", (unsigned long)w->kernel_time);
+        }
+        if (counters) {
+            counters->report(report);
+            uint64_t pages = (bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+            CounterValues process = counters->stage_total(STAGE_PROCESS);
+            if (pages > 0 && counters->is_available(COUNTER_DTLB_MISSES)) {
+                report.section("counters").set("process.dtlb-misses_per_page",
+                        (double)process.values[COUNTER_DTLB_MISSES] / pages);
+            }
+        }
+        if (latency) {
+            latency->report(report);
+        }
+        if (residency) {
+            residency->report(report);
+        }
+        if (traffic) {
+            traffic->report(report, result.elapsed);
+        }
+        if (vars.files.size() > 1) {
+            report_file_results(report, result);
+        }
+        if (vars.instances > 1) {
+            for (size_t i = 0; i < instances.size(); i++) {
+                Report::Section &s = report.row("instance", i);
+                s.set("elapsed_ns", (unsigned long)instances[i].elapsed.tv_sec * NSECS_IN_SEC + instances[i].elapsed.tv_nsec);
+                s.set("bandwidth_mbps", ((double)instances[i].visited / to_seconds(instances[i].elapsed)) / (double)BYTES_IN_MBYTE);
+                s.set("stall_s", instances[i].source->stall_time());
+            }
+        }
+        report.print(vars.format);
+        return 0;
+    }
 
-    std::cout << "sum=" << global_sum << std::endl;
+    std::cout << "sum=" << result.sum << std::endl;
 
-    timespec diff = time_diff(start, end);
+    print_results(bytes, result.elapsed);
+    print_iops(result.accesses, result.elapsed);
+    if (vars.cold) {
+        print_eviction(eviction);
+    }
+    if (vars.instances > 1) {
+        for (size_t i = 0; i < instances.size(); i++) {
+            printf("Instance %zu bandwidth (MB/s): %f\n", i,
+                    ((double)instances[i].visited / to_seconds(instances[i].elapsed)) / (double)BYTES_IN_MBYTE);
+        }
+    }
+    if (vars.files.size() > 1) {
+        printf("Files: %zu, %s\n", vars.files.size(), file_schedule_name(vars.file_schedule));
+        print_file_results(result);
+    }
+    printf("Backend: %s\n", backend_name(vars.backend));
+    printf("Page size: %zu, huge pages: %s\n", system_page_size(), vars.huge_pages ? "yes" : "no");
+    for (size_t i = 0; i < instances.size(); i++) {
+        if (vars.instances > 1) {
+            printf("Instance %zu:\n", i);
+        }
+        instances[i].source->print_stats();
+    }
+    printf("Input stall (s): %f\n", stall);
+    printf("Affinity: %s%s\n", affinity_name(vars.affinity), vars.membind ? ", membind" : "");
+    if (traffic) {
+        traffic->print(result.elapsed);
+    }
+    print_kernel_results(vars.kernel, result.isa, bytes,
+            (double)result.kernel_time / (double)NSECS_IN_SEC);
+
+    if (counters) {
+        counters->print();
+        uint64_t pages = (bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+        CounterValues process = counters->stage_total(STAGE_PROCESS);
+        if (pages > 0 && counters->is_available(COUNTER_INSTRUCTIONS)) {
+            printf("Process instr/page: %lu\n", process.values[COUNTER_INSTRUCTIONS] / pages);
+        }
+        // Compare with and without --huge-pages
+        if (pages > 0 && counters->is_available(COUNTER_DTLB_MISSES)) {
+            printf("Process dTLB misses/page: %f\n", (double)process.values[COUNTER_DTLB_MISSES] / pages);
+        }
+    }
 
-    double time = (double)diff.tv_sec + ((double)diff.tv_nsec / (double)NSECS_IN_SEC);
-    printf("Time (s): %ld.%ld\n", diff.tv_sec, diff.tv_nsec / NSECS_IN_MSEC);
-    printf("Bandwidth (MB/s): %f\n", ((double)filesize/time)/(double)BYTES_IN_MBYTE);
+    if (latency) {
+        latency->print_text();
+    }
+    if (residency) {
+        residency->print_text();
+    }
 }
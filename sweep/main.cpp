@@ -0,0 +1,483 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+
+#include "chunk_source.h"
+#include "kernels.h"
+#include "page_cache.h"
+#include "perf_counters.h"
+#include "pipeline.h"
+#include "report.h"
+#include "util.h"
+
+#define PROGNAME "sweep"
+
+static const char *const progname = PROGNAME;
+
+static const int DEFAULT_ITERATIONS = 10000;
+static const int DEFAULT_META_CHUNK_SIZE = 2048 * PAGE_SIZE;
+static const int DEFAULT_PREFETCH = 1;
+static const int DEFAULT_QUEUE_DEPTH = 8;
+static const int DEFAULT_WARMUP = 1;
+static const int DEFAULT_TRIALS = 5;
+static const int DEFAULT_RERUNS = 2;
+static const double DEFAULT_MAX_CV = 5.0;
+
+// Every list is a dimension of the grid
+struct Vars {
+    // Files of the file or directory given
+    std::vector<std::string> files;
+    std::vector<long> iterations;
+    std::vector<long> threads;
+    std::vector<long> chunk_sizes;
+    std::vector<long> meta_chunk_sizes;
+    // 0 is the number of threads of the point
+    std::vector<long> ntokens;
+    std::vector<Kernel> kernels;
+    std::vector<Backend> backends;
+    // 0 or 1, see SourceOptions::huge_pages
+    std::vector<long> huge_pages;
+    int warmup = -1;
+    int trials = 0;
+    // Coefficient of variation, in percent, above which a point is noisy
+    double max_cv = -1;
+    // Times a noisy point is measured again before giving up
+    int reruns = -1;
+    // Evict the file from the page cache before every measured run
+    bool cold = false;
+    // Count dTLB misses of every run, which costs each stage counter
+    // reads per chunk
+    bool counters = false;
+    OutputFormat format = FORMAT_TEXT;
+    bool verbose = false;
+};
+
+__attribute__((noreturn))
+static void usage(void) {
+    fprintf(stderr, "Usage: %s [OPTIONS] file|directory\n", progname);
+    fprintf(stderr, "\nRuns the pipelined reader in-process over every combination of the given\n");
+    fprintf(stderr, "values. Lists are comma-separated.\n");
+    fprintf(stderr, "\nOptions:\n\n");
+    fprintf(stderr, "  --iterations, -i         list of iterations per page\n");
+    fprintf(stderr, "  --threads, -t            list of thread counts\n");
+    fprintf(stderr, "  --chunk-size, -c         list of chunk sizes (default: metachunk size)\n");
+    fprintf(stderr, "  --meta-chunk-size, -m    list of metachunk sizes\n");
+    fprintf(stderr, "  --ntokens, -n            list of tokens in pipeline (default: threads)\n");
+    fprintf(stderr, "  --kernel, -k             list of kernels: touch, crc32c, histogram or scan\n");
+    fprintf(stderr, "  --backend, -b            list of backends: mmap, pread, direct, splice or uring\n");
+    fprintf(stderr, "  --huge-pages, -H         list of 0 (base pages) or 1 (huge pages)\n");
+    fprintf(stderr, "  --warmup, -W             set number of discarded runs per point\n");
+    fprintf(stderr, "  --trials, -r             set number of measured runs per point\n");
+    fprintf(stderr, "  --max-cv, -e             set coefficient of variation (%%) above which a point is noisy\n");
+    fprintf(stderr, "  --reruns, -R             set number of times a noisy point is measured again\n");
+    fprintf(stderr, "  --cold, -d               evict the file from the page cache before every trial\n");
+    fprintf(stderr, "  --counters, -C           count dTLB misses of every trial (slows the pipeline down)\n");
+    fprintf(stderr, "  --format, -o             print results as text (default), json or csv\n");
+    fprintf(stderr, "  --verbose, -v            print every trial on stderr\n");
+    exit(EXIT_FAILURE);
+}
+
+static std::vector<std::string> split(const char *list) {
+    std::vector<std::string> ret;
+    std::string s(list);
+    size_t start = 0;
+    while (start <= s.size()) {
+        size_t end = s.find(',', start);
+        if (end == std::string::npos) {
+            end = s.size();
+        }
+        if (end > start) {
+            ret.push_back(s.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return ret;
+}
+
+static std::vector<long> parse_numbers(const char *list) {
+    std::vector<long> ret;
+    for (const std::string &item : split(list)) {
+        ret.push_back(atol(item.c_str()));
+    }
+    return ret;
+}
+
+static void parse_opts(int argc, char **argv, Vars &vars) {
+    int opt;
+
+    struct option options[] = {
+        { "help",   0, 0, 'h' },
+        { "verbose",   0, 0, 'v' },
+        { "cold",   0, 0, 'd' },
+        { "counters",   0, 0, 'C' },
+        { "iterations",   1, 0, 'i' },
+        { "threads",   1, 0, 't' },
+        { "chunk-size",   1, 0, 'c' },
+        { "meta-chunk-size",   1, 0, 'm' },
+        { "ntokens",   1, 0, 'n' },
+        { "kernel",   1, 0, 'k' },
+        { "backend",   1, 0, 'b' },
+        { "huge-pages",   1, 0, 'H' },
+        { "warmup",   1, 0, 'W' },
+        { "trials",   1, 0, 'r' },
+        { "max-cv",   1, 0, 'e' },
+        { "reruns",   1, 0, 'R' },
+        { "format",   1, 0, 'o' },
+        { 0, 0, 0, 0 },
+    };
+    int idx;
+
+    while ((opt = getopt_long(argc, argv, "hvdCi:t:c:m:n:k:b:H:W:r:e:R:o:", options, &idx)) != -1) {
+        switch (opt) {
+            case 'i':
+                vars.iterations = parse_numbers(optarg);
+                break;
+            case 't':
+                vars.threads = parse_numbers(optarg);
+                break;
+            case 'c':
+                vars.chunk_sizes = parse_numbers(optarg);
+                break;
+            case 'm':
+                vars.meta_chunk_sizes = parse_numbers(optarg);
+                break;
+            case 'n':
+                vars.ntokens = parse_numbers(optarg);
+                break;
+            case 'k':
+                vars.kernels.clear();
+                for (const std::string &name : split(optarg)) {
+                    Kernel kernel;
+                    if (!parse_kernel(name.c_str(), kernel)) {
+                        fprintf(stderr, "Unknown kernel: %s\n", name.c_str());
+                        usage();
+                    }
+                    vars.kernels.push_back(kernel);
+                }
+                break;
+            case 'b':
+                vars.backends.clear();
+                for (const std::string &name : split(optarg)) {
+                    Backend backend;
+                    if (!parse_backend(name.c_str(), backend)) {
+                        fprintf(stderr, "Unknown backend: %s\n", name.c_str());
+                        usage();
+                    }
+                    vars.backends.push_back(backend);
+                }
+                break;
+            case 'H':
+                vars.huge_pages = parse_numbers(optarg);
+                break;
+            case 'W':
+                vars.warmup = atoi(optarg);
+                break;
+            case 'r':
+                vars.trials = atoi(optarg);
+                break;
+            case 'e':
+                vars.max_cv = atof(optarg);
+                break;
+            case 'R':
+                vars.reruns = atoi(optarg);
+                break;
+            case 'o':
+                if (!parse_format(optarg, vars.format)) {
+                    fprintf(stderr, "Unknown output format: %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'v':
+                vars.verbose = true;
+                break;
+            case 'd':
+                vars.cold = true;
+                break;
+            case 'C':
+                vars.counters = true;
+                break;
+            case 'h':
+                usage();
+                break;
+            default:
+                usage();
+                break;
+        }
+    }
+
+    // Non-option arg for filename
+    if (optind >= argc) {
+        fprintf(stderr, "File name missing.\n");
+        usage();
+    } else {
+        vars.files = expand_inputs({ argv[optind] });
+    }
+
+    // Default values
+    if (vars.iterations.empty()) {
+        vars.iterations.push_back(DEFAULT_ITERATIONS);
+    }
+    if (vars.threads.empty()) {
+        vars.threads.push_back(1);
+    }
+    if (vars.meta_chunk_sizes.empty()) {
+        vars.meta_chunk_sizes.push_back(DEFAULT_META_CHUNK_SIZE);
+    }
+    if (vars.chunk_sizes.empty()) {
+        vars.chunk_sizes.push_back(0);
+    }
+    if (vars.ntokens.empty()) {
+        vars.ntokens.push_back(0);
+    }
+    if (vars.kernels.empty()) {
+        vars.kernels.push_back(KERNEL_TOUCH);
+    }
+    if (vars.backends.empty()) {
+        vars.backends.push_back(BACKEND_MMAP);
+    }
+    if (vars.huge_pages.empty()) {
+        vars.huge_pages.push_back(0);
+    }
+    if (vars.warmup < 0) {
+        vars.warmup = DEFAULT_WARMUP;
+    }
+    if (vars.trials <= 0) {
+        vars.trials = DEFAULT_TRIALS;
+    }
+    if (vars.max_cv < 0) {
+        vars.max_cv = DEFAULT_MAX_CV;
+    }
+    if (vars.reruns < 0) {
+        vars.reruns = DEFAULT_RERUNS;
+    }
+}
+
+static off_t round_to_page(off_t size, bool huge) {
+    return round_up(size, huge ? huge_page_size() : system_page_size());
+}
+
+// Two-sided 95% Student t quantiles for 1 to 30 degrees of freedom
+static const double t_95[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+};
+
+struct Summary {
+    double median = 0;
+    double mean = 0;
+    double stddev = 0;
+    // Half-width of the 95% confidence interval of the mean
+    double ci95 = 0;
+    // Coefficient of variation, in percent
+    double cv = 0;
+};
+
+static Summary summarize(std::vector<double> samples) {
+    Summary s;
+    size_t n = samples.size();
+    if (n == 0) {
+        return s;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    s.median = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+    for (double x : samples) {
+        s.mean += x;
+    }
+    s.mean /= n;
+    if (n < 2) {
+        return s;
+    }
+
+    double squares = 0;
+    for (double x : samples) {
+        squares += (x - s.mean) * (x - s.mean);
+    }
+    s.stddev = sqrt(squares / (n - 1));
+    double t = n - 1 <= 30 ? t_95[n - 2] : 1.960;
+    s.ci95 = t * s.stddev / sqrt((double)n);
+    s.cv = s.mean > 0 ? 100.0 * s.stddev / s.mean : 0;
+    return s;
+}
+
+// Measurements of one point of the grid
+struct Point {
+    PipelineConfig config;
+    std::vector<double> bandwidth;
+    std::vector<double> elapsed;
+    // Over all stages, empty without --counters or if the counter is
+    // not available
+    std::vector<double> dtlb_misses;
+    Summary summary;
+    int attempts = 0;
+    bool noisy = false;
+};
+
+static void measure(const Vars &vars, Point &point) {
+    // Warmups run with the same probes as the trials
+    for (int i = 0; i < vars.warmup; i++) {
+        PerfCounters counters(pipeline_stages);
+        PipelineProbes probes;
+        if (vars.counters) probes.counters = &counters;
+        PipelinedReader(point.config, probes).run();
+    }
+
+    point.bandwidth.clear();
+    point.elapsed.clear();
+    point.dtlb_misses.clear();
+    for (int i = 0; i < vars.trials; i++) {
+        if (vars.cold) {
+            for (const std::string &file : point.config.files) {
+                Eviction eviction = evict_file(file);
+                if (vars.verbose) {
+                    fprintf(stderr, "  evicted %s: %.1f%% -> %.1f%% resident\n", file.c_str(),
+                            eviction.before, eviction.after);
+                }
+            }
+        }
+        PerfCounters counters(pipeline_stages);
+        PipelineProbes probes;
+        if (vars.counters) probes.counters = &counters;
+        PipelineResult result = PipelinedReader(point.config, probes).run();
+        if (vars.counters && counters.is_available(COUNTER_DTLB_MISSES)) {
+            uint64_t misses = 0;
+            for (size_t stage = 0; stage < pipeline_stages.size(); stage++) {
+                misses += counters.stage_total(stage).values[COUNTER_DTLB_MISSES];
+            }
+            point.dtlb_misses.push_back(misses);
+        }
+        double seconds = to_seconds(result.elapsed);
+        double mbps = ((double)result.visited / seconds) / (double)BYTES_IN_MBYTE;
+        point.bandwidth.push_back(mbps);
+        point.elapsed.push_back(seconds * NSECS_IN_SEC);
+        if (vars.verbose) {
+            fprintf(stderr, "  trial %d: %f MB/s\n", i + 1, mbps);
+        }
+    }
+    point.summary = summarize(point.bandwidth);
+}
+
+// Measures a point, and again while it is noisy. The attempt with the
+// lowest variation is kept.
+static void run_point(const Vars &vars, Point &point) {
+    Point best = point;
+    for (int attempt = 0; attempt <= vars.reruns; attempt++) {
+        if (vars.verbose) {
+            fprintf(stderr, "%s threads %d chunk %ld metachunk %ld ntokens %d %s%s\n",
+                    backend_name(point.config.backend), point.config.threads,
+                    point.config.chunk_size, point.config.meta_chunk_size,
+                    point.config.ntokens, kernel_name(point.config.kernel),
+                    attempt > 0 ? " (rerun)" : "");
+        }
+        measure(vars, point);
+        if (attempt == 0 || point.summary.cv < best.summary.cv) {
+            best = point;
+        }
+        best.attempts = attempt + 1;
+        if (point.summary.cv <= vars.max_cv) {
+            break;
+        }
+    }
+    best.noisy = best.summary.cv > vars.max_cv;
+    point = best;
+}
+
+static void print_point(const Vars &vars, const Point &point, bool first) {
+    const PipelineConfig &c = point.config;
+    const Summary &s = point.summary;
+    if (vars.format == FORMAT_TEXT) {
+        printf("%s %s i=%d t=%d n=%d c=%ld m=%ld h=%d: %f MB/s median, %f stddev, +-%f (95%%), cv %.1f%%",
+                backend_name(c.backend), kernel_name(c.kernel), c.iterations, c.threads,
+                c.ntokens, c.chunk_size, c.meta_chunk_size, c.huge_pages, s.median, s.stddev,
+                s.ci95, s.cv);
+        if (!point.dtlb_misses.empty()) {
+            printf(", %.0f dTLB misses", summarize(point.dtlb_misses).median);
+        }
+        printf("%s\n", point.noisy ? " noisy" : "");
+        return;
+    }
+
+    Report report;
+    Report::Section &params = report.section("params");
+    params.set("backend", backend_name(c.backend));
+    params.set("kernel", kernel_name(c.kernel));
+    params.set("iterations", c.iterations);
+    params.set("threads", c.threads);
+    params.set("ntokens", c.ntokens);
+    params.set("chunk_size", (long)c.chunk_size);
+    params.set("meta_chunk_size", (long)c.meta_chunk_size);
+    params.set("window", c.window);
+    params.set("prefetch", c.prefetch);
+    params.set("huge_pages", c.huge_pages);
+    params.set("cold", vars.cold);
+    params.set("counters", vars.counters);
+
+    Report::Section &results = report.section("results");
+    results.set("trials", (int)point.bandwidth.size());
+    results.set("attempts", point.attempts);
+    results.set("noisy", point.noisy);
+    results.set("bandwidth_mbps_median", s.median);
+    results.set("bandwidth_mbps_mean", s.mean);
+    results.set("bandwidth_mbps_stddev", s.stddev);
+    results.set("bandwidth_mbps_ci95", s.ci95);
+    results.set("bandwidth_mbps_cv", s.cv);
+    results.set("elapsed_ns_median", summarize(point.elapsed).median);
+    if (!point.dtlb_misses.empty()) {
+        results.set("dtlb_misses_median", summarize(point.dtlb_misses).median);
+    }
+    report.print(vars.format, first);
+}
+
+int main(int argc, char **argv) {
+    Vars vars;
+    parse_opts(argc, argv, vars);
+
+    Isa isa = detect_isa();
+    bool first = true;
+    for (Backend backend : vars.backends)
+    for (long huge_pages : vars.huge_pages)
+    for (Kernel kernel : vars.kernels)
+    for (long iterations : vars.iterations)
+    for (long meta_chunk_size : vars.meta_chunk_sizes)
+    for (long chunk_size : vars.chunk_sizes)
+    for (long threads : vars.threads)
+    for (long ntokens : vars.ntokens) {
+        Point point;
+        PipelineConfig &c = point.config;
+        c.files = vars.files;
+        c.iterations = iterations;
+        c.threads = threads;
+        c.ntokens = ntokens > 0 ? ntokens : threads;
+        c.huge_pages = huge_pages != 0;
+        // Metachunks only get huge pages if they start on a huge page
+        c.meta_chunk_size = round_to_page(meta_chunk_size, c.huge_pages && backend == BACKEND_MMAP);
+        c.chunk_size = round_to_page(chunk_size > 0 ? chunk_size : c.meta_chunk_size, false);
+        c.prefetch = DEFAULT_PREFETCH;
+        c.window = c.ntokens + 1 + c.prefetch;
+        c.backend = backend;
+        c.queue_depth = DEFAULT_QUEUE_DEPTH;
+        c.kernel = kernel;
+        c.isa = isa;
+        // Not a valid point, said on stderr so that csv and json
+        // output stay clean
+        if (c.chunk_size > c.meta_chunk_size) {
+            fprintf(stderr, "Skipping %s %s i=%d t=%d n=%d c=%ld m=%ld h=%d: chunk larger than metachunk\n",
+                    backend_name(c.backend), kernel_name(c.kernel), c.iterations, c.threads,
+                    c.ntokens, c.chunk_size, c.meta_chunk_size, c.huge_pages);
+            continue;
+        }
+
+        run_point(vars, point);
+        print_point(vars, point, first);
+        fflush(stdout);
+        first = false;
+    }
+}